@@ -6,6 +6,28 @@
 #include <string>
 #include <random>
 #include <algorithm>
+#include <unordered_map>
+#include <map>
+#include <cstring>
+#include <cstdint>
+#include <chrono>
+#include <filesystem>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
 
 #define GLEW_STATIC 1
 #include <GL/glew.h>
@@ -14,10 +36,16 @@
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/common.hpp>
+#include <glm/gtc/packing.hpp>
 
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
 
+#if defined(__SSE2__) || defined(_M_X64)
+#define HAVE_SSE2 1
+#include <emmintrin.h>
+#endif
+
 using namespace glm;
 using namespace std;
 
@@ -32,9 +60,9 @@ float lastX = WINDOW_WIDTH / 2.0f, lastY = WINDOW_HEIGHT / 2.0f;
 
 float deltaTime = 0.0f, lastFrame = 0.0f;
 
-const int STAR_COUNT = 50000;
 const float STAR_FIELD_RADIUS = 4000.0f;
 GLuint starfieldVAO; int starfieldVertexCount;
+vector<float> starfieldBrightness;        // ascending, kept when the stars are sorted for the skybox
 
 const int SHOOTING_STAR_COUNT = 20;
 const float SHOOTING_STAR_SPEED = 50.0f;
@@ -48,166 +76,252 @@ struct ShootingStar {
 };
 vector<ShootingStar> shootingStars;
 
-GLuint sunTexture, mercuryTexture, venusTexture, earthTexture, marsTexture, jupiterTexture;
-GLuint saturnTexture, uranusTexture, neptuneTexture, moonTexture, ringTexture;
+// Body textures; with --texture-array the index is also the body's layer in bodyTextureArray
+enum BodyTexture { TEX_SUN, TEX_MERCURY, TEX_VENUS, TEX_EARTH, TEX_MARS, TEX_JUPITER, TEX_SATURN,
+                   TEX_URANUS, TEX_NEPTUNE, TEX_MOON, TEX_RING, BODY_TEXTURE_COUNT };
+const char* BODY_TEXTURE_FILES[BODY_TEXTURE_COUNT] = {
+    "textures/sun.jpg", "textures/mercury.jpg", "textures/venus.jpg", "textures/earth.jpg",
+    "textures/mars.jpg", "textures/jupiter.jpg", "textures/saturn.jpg", "textures/uranus.jpg",
+    "textures/neptune.jpg", "textures/moon.jpg", "textures/rings.jpg",
+};
+GLuint bodyTextures[BODY_TEXTURE_COUNT];  // one GL_TEXTURE_2D each, unused with --texture-array
 
 float orbitSpeedMultiplier = 1.0f;
 bool pausedOrbits = false;
 
 vector<float> createTexturedSphere(float radius, vec3 color);
-int createTexturedSphereVBO(vector<float>& v);
 vector<vec3> createOrbitPath(float radius);
 int createOrbitVBO(vector<vec3>& orbitVertices);
-vector<float> createRing(float innerR, float outerR, vec3 color);
 
-int compileShader(GLenum type, const char* src){
+// Every stage is compiled as GLSL_VERSION + permutation defines + FRAME_DATA_GLSL + body,
+// so all programs share the FrameData block.
+const char* GLSL_VERSION = "#version 330 core\n";
+const char* FRAME_DATA_GLSL = R"GLSL(
+layout(std140) uniform FrameData {
+    mat4 viewMatrix;
+    mat4 projectionMatrix;
+    vec3 viewPos;
+    vec3 sunPosition; // position of the sun (origin)
+    vec3 lightColor;
+};
+)GLSL";
+const GLuint FRAME_DATA_BINDING = 0;
+
+// CPU mirror of FrameData; std140 pads every vec3 to 16 bytes.
+struct FrameData {
+    mat4 viewMatrix;
+    mat4 projectionMatrix;
+    vec4 viewPos, sunPosition, lightColor;
+};
+GLuint frameUBO = 0;
+
+int compileShader(GLenum type, const char* src, const char* defines=""){
     int sh = glCreateShader(type);
-    glShaderSource(sh,1,&src,nullptr);
+    const char* srcs[] = { GLSL_VERSION, defines, FRAME_DATA_GLSL, src };
+    glShaderSource(sh,4,srcs,nullptr);
     glCompileShader(sh);
     int ok; char log[1024]; glGetShaderiv(sh,GL_COMPILE_STATUS,&ok);
     if(!ok){ glGetShaderInfoLog(sh,1024,nullptr,log); cerr<<"Shader compile error:\n"<<log<<endl; }
     return sh;
 }
-int linkProgram(const char* vs, const char* fs){
-    int v=compileShader(GL_VERTEX_SHADER,vs);
-    int f=compileShader(GL_FRAGMENT_SHADER,fs);
-    int p=glCreateProgram(); glAttachShader(p,v); glAttachShader(p,f); glLinkProgram(p);
-    int ok; char log[1024]; glGetProgramiv(p,GL_LINK_STATUS,&ok);
-    if(!ok){ glGetProgramInfoLog(p,1024,nullptr,log); cerr<<"Program link error:\n"<<log<<endl; }
-    glDeleteShader(v); glDeleteShader(f); return p;
+// Linked programs are saved with glGetProgramBinary under shadercache/, keyed by a hash of the full
+// source and the driver strings. A binary the driver rejects (e.g. after an update) is recompiled and replaced.
+const char* SHADER_CACHE_DIR = "shadercache";
+bool shaderCacheEnabled = true;
+struct ShaderCacheStats { int hits=0, misses=0, rejected=0; double ms=0.0; };
+ShaderCacheStats shaderCacheStats;
+
+uint64_t fnv1a(const void* data, size_t n, uint64_t h=1469598103934665603ull){
+    const unsigned char* p = (const unsigned char*)data;
+    for(size_t i=0;i<n;++i){ h ^= p[i]; h *= 1099511628211ull; }
+    return h;
+}
+uint64_t fnv1a(const char* str, uint64_t h=1469598103934665603ull){ return fnv1a(str, strlen(str), h); }
+
+bool programBinarySupported(){
+    if(!shaderCacheEnabled || !GLEW_ARB_get_program_binary) return false;
+    GLint formats = 0; glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS,&formats);
+    return formats>0;
+}
+string programCachePath(const char* vs, const char* fs, const char* defines){
+    uint64_t h = fnv1a(GLSL_VERSION);
+    for(const char* part: { defines, FRAME_DATA_GLSL, vs, fs }) h = fnv1a(part,h);
+    for(GLenum e: { GL_VENDOR, GL_RENDERER, GL_VERSION }) h = fnv1a((const char*)glGetString(e),h);
+    char name[32]; snprintf(name,sizeof(name),"%016llx.bin",(unsigned long long)h);
+    return string(SHADER_CACHE_DIR)+"/"+name;
+}
+GLuint loadProgramBinary(const string& path){
+    ifstream f(path, ios::binary);
+    if(!f.good()) return 0;
+    GLenum format; f.read((char*)&format,sizeof(format));
+    vector<char> bin((istreambuf_iterator<char>(f)), istreambuf_iterator<char>());
+    if(!f.eof() || bin.empty()) return 0;
+    GLuint p = glCreateProgram();
+    glProgramBinary(p,format,bin.data(),(GLsizei)bin.size());
+    GLint ok; glGetProgramiv(p,GL_LINK_STATUS,&ok);
+    if(!ok){ glDeleteProgram(p); ++shaderCacheStats.rejected; return 0; }
+    return p;
+}
+void saveProgramBinary(GLuint p, const string& path){
+    GLint len = 0; glGetProgramiv(p,GL_PROGRAM_BINARY_LENGTH,&len);
+    if(len<=0) return;
+    vector<char> bin(len); GLenum format;
+    glGetProgramBinary(p,len,nullptr,&format,bin.data());
+    error_code ec; filesystem::create_directories(SHADER_CACHE_DIR,ec);
+    // Renamed into place, so another instance or a crash never sees a truncated binary
+    string tmp = path+".tmp";
+    {
+        ofstream f(tmp, ios::binary);
+        f.write((const char*)&format,sizeof(format));
+        f.write(bin.data(),bin.size());
+        if(!f.good()) return;
+    }
+    filesystem::rename(tmp,path,ec);
+}
+
+int linkProgram(const char* vs, const char* fs, const char* defines=""){
+    auto start = chrono::steady_clock::now();
+    bool useCache = programBinarySupported();
+    string cachePath = useCache ? programCachePath(vs,fs,defines) : string();
+    GLuint p = useCache ? loadProgramBinary(cachePath) : 0;
+    if(p) ++shaderCacheStats.hits;
+    else{
+        int v=compileShader(GL_VERTEX_SHADER,vs,defines);
+        int f=compileShader(GL_FRAGMENT_SHADER,fs,defines);
+        p=glCreateProgram(); glAttachShader(p,v); glAttachShader(p,f);
+        if(useCache) glProgramParameteri(p,GL_PROGRAM_BINARY_RETRIEVABLE_HINT,GL_TRUE);
+        glLinkProgram(p);
+        int ok; char log[1024]; glGetProgramiv(p,GL_LINK_STATUS,&ok);
+        if(!ok){ glGetProgramInfoLog(p,1024,nullptr,log); cerr<<"Program link error:\n"<<log<<endl; }
+        else if(useCache) saveProgramBinary(p,cachePath);
+        glDeleteShader(v); glDeleteShader(f);
+        ++shaderCacheStats.misses;
+    }
+    GLuint block = glGetUniformBlockIndex(p,"FrameData");
+    if(block!=GL_INVALID_INDEX) glUniformBlockBinding(p,block,FRAME_DATA_BINDING);
+    shaderCacheStats.ms += chrono::duration<double,milli>(chrono::steady_clock::now()-start).count();
+    return p;
 }
 
+// VS_MAIN/FS_MAIN are compiled once per MainVariant; the defines strip the code paths a variant never takes.
+enum MainVariant { VARIANT_EMISSIVE, VARIANT_UNLIT, VARIANT_LIT, VARIANT_LIT_ECLIPSE, MAIN_VARIANT_COUNT };
+const char* MAIN_VARIANT_NAMES[MAIN_VARIANT_COUNT] = { "emissive", "unlit", "lit", "lit+eclipse" };
+const char* MAIN_VARIANT_DEFINES[MAIN_VARIANT_COUNT] = {
+    "#define EMISSIVE\n",
+    "#define UNLIT\n",
+    "#define LIT\n",
+    "#define LIT\n#define ECLIPSE_RECEIVER\n",
+};
+
 const char* VS_MAIN = R"GLSL(
-#version 330 core
+#ifdef PROCEDURAL_SPHERE
+// Unit sphere generated from gl_VertexID with no vertex buffer: six vertices per quad of a
+// segments x rings grid, drawn with glDrawArrays(GL_TRIANGLES, 0, segments*rings*6).
+uniform ivec2 sphereTess; // segments, rings
+const int QUAD_ROW[6] = int[6](0,0,1, 0,1,1);
+const int QUAD_COL[6] = int[6](0,1,0, 1,1,0);
+#else
 layout(location=0) in vec3 aPos;
-layout(location=1) in vec3 aColor;
 layout(location=2) in vec2 aTexCoord;
+#endif
+#ifdef PACKED_VERTEX
+layout(location=3) in vec2 aOctNormal;
+vec3 octDecode(vec2 e){
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    float t = max(-n.z, 0.0);
+    n.xy += vec2(n.x >= 0.0 ? -t : t, n.y >= 0.0 ? -t : t);
+    return normalize(n);
+}
+#elif !defined(PROCEDURAL_SPHERE)
 layout(location=3) in vec3 aNormal;
+#endif
 
-uniform mat4 worldMatrix;
-uniform mat4 viewMatrix;
-uniform mat4 projectionMatrix;
+uniform mat4 worldMatrix; // includes the body's radius scale
 
-out vec3 vColor;
 out vec2 vUV;
+#ifdef LIT
 out vec3 vWorldPos;
 out vec3 vNormal;
+#endif
 
 void main(){
-    vColor = aColor;
+#ifdef PROCEDURAL_SPHERE
+    // Same parameterisation as buildIndexedSphere; the pole quads give zero-area triangles the rasteriser drops
+    int quad = gl_VertexID / 6, corner = gl_VertexID - quad*6;
+    ivec2 rc = ivec2(quad / sphereTess.x + QUAD_ROW[corner], quad % sphereTess.x + QUAD_COL[corner]);
+    vec2 aTexCoord = vec2(rc.y, rc.x) / vec2(sphereTess);
+    float theta = aTexCoord.y * 3.14159265359, phi = aTexCoord.x * 6.28318530718;
+    vec3 aPos = vec3(sin(theta)*cos(phi), cos(theta), sin(theta)*sin(phi));
+    vec3 aNormal = aPos;
+#endif
     vUV = aTexCoord;
     vec4 wp = worldMatrix * vec4(aPos,1.0);
+#ifdef LIT
+#ifdef PACKED_VERTEX
+    vec3 aNormal = octDecode(aOctNormal);
+#endif
     vWorldPos = wp.xyz;
     vNormal = mat3(transpose(inverse(worldMatrix))) * aNormal;
+#endif
     gl_Position = projectionMatrix * viewMatrix * wp;
 }
 )GLSL";
 
-const char* FS_MAIN = R"GLSL(
-#version 330 core
-in vec3 vColor;
-in vec2 vUV;
-in vec3 vWorldPos;
-in vec3 vNormal;
-out vec4 FragColor;
-
+// Surface shading shared by the mesh path (FS_MAIN) and the ray-cast impostors (FS_IMPOSTOR)
+const char* SHADE_GLSL = R"GLSL(
+#ifdef TEXTURE_ARRAY
+uniform sampler2DArray texture1;
+uniform float textureLayer;
+#else
 uniform sampler2D texture1;
+#endif
 uniform bool useTexture;
-uniform bool isSun;
-uniform bool useLighting;
-
-uniform vec3 viewPos;
+uniform vec3 tint; // colour of untextured draws
 
+#ifdef LIT
 // Phong material
 uniform vec3 Ka; // ambient
 uniform vec3 Kd; // diffuse
 uniform vec3 Ks; // spec
 uniform float shininess;
+#endif
 
-// Simple sun lighting from origin
-uniform vec3 sunPosition; // position of the sun (origin)
-uniform vec3 lightColor;
+#ifdef ECLIPSE_RECEIVER
+// Body that can shadow this one (Earth for the moon, the moon for Earth) and its shadow radius
+uniform vec3 occluderPosition;
+uniform float shadowRadius;
 
-// Earth shadow for moon
-uniform bool isMoon;
-uniform bool isEarth;
-uniform vec3 earthPosition;
-uniform vec3 moonPosition;
-uniform float earthRadius;
-uniform float moonRadius;
+float eclipseShadow(vec3 worldPos){
+    vec3 sunToSurface = worldPos - sunPosition;
+    vec3 sunToOccluder = occluderPosition - sunPosition;
+    if(length(sunToSurface) <= length(sunToOccluder)) return 0.0;
 
-void main(){
-    // emissive Sun
-    if(isSun){
-        vec3 col = (useTexture ? texture(texture1, vUV).rgb : vColor);
-        float glow = 1.5 + 0.3 * sin(gl_FragCoord.x*0.01) * cos(gl_FragCoord.y*0.01);
-        col = mix(col*glow, vec3(1.0,0.9,0.6), 0.3);
-        FragColor = vec4(col,1.0);
-        return;
-    }
+    vec3 axis = normalize(sunToOccluder);
+    vec3 closestPointOnLine = sunPosition + axis * dot(sunToSurface, axis);
+    float distanceToLine = length(worldPos - closestPointOnLine);
+    if(distanceToLine >= shadowRadius) return 0.0;
 
-    vec3 base = useTexture ? texture(texture1, vUV).rgb : vColor;
+    float shadowStrength = 1.0 - (distanceToLine / shadowRadius);
+    return shadowStrength * shadowStrength;
+}
+#endif
 
-    if(!useLighting){
-        FragColor = vec4(base,1.0);
-        return;
-    }
+// N must be normalized; worldPos and N are ignored by the emissive and unlit variants
+vec3 shadeSurface(vec2 uv, vec3 worldPos, vec3 N){
+#ifdef TEXTURE_ARRAY
+    vec3 base = useTexture ? texture(texture1, vec3(uv, textureLayer)).rgb : tint;
+#else
+    vec3 base = useTexture ? texture(texture1, uv).rgb : tint;
+#endif
 
-    vec3 N = normalize(vNormal);
-    vec3 V = normalize(viewPos - vWorldPos);
-    vec3 L = normalize(sunPosition - vWorldPos); // vector from surface to sun at origin
+#if defined(EMISSIVE)
+    float glow = 1.5 + 0.3 * sin(gl_FragCoord.x*0.01) * cos(gl_FragCoord.y*0.01);
+    return mix(base*glow, vec3(1.0,0.9,0.6), 0.3);
+#elif defined(LIT)
+    vec3 V = normalize(viewPos - worldPos);
+    vec3 L = normalize(sunPosition - worldPos); // vector from surface to sun at origin
     float ndotl = max(dot(N,L),0.0);
 
-    // Check for Earth shadow on moon AND moon shadow on Earth
-    float earthShadow = 0.0;
-    float moonShadow = 0.0;
-    
-    if(isMoon){
-        // Moon being shadowed by Earth (lunar eclipse)
-        vec3 sunToMoon = vWorldPos - sunPosition;
-        vec3 sunToEarth = earthPosition - sunPosition;
-        
-        float sunMoonDist = length(sunToMoon);
-        float sunEarthDist = length(sunToEarth);
-        
-        if(sunMoonDist > sunEarthDist){
-            vec3 sunToEarthNorm = normalize(sunToEarth);
-            float projectionLength = dot(sunToMoon, sunToEarthNorm);
-            vec3 closestPointOnLine = sunPosition + sunToEarthNorm * projectionLength;
-            
-            float distanceToLine = length(vWorldPos - closestPointOnLine);
-            
-            float shadowRadius = earthRadius * 1.2;
-            if(distanceToLine < shadowRadius){
-                float shadowStrength = 1.0 - (distanceToLine / shadowRadius);
-                earthShadow = shadowStrength * shadowStrength;
-            }
-        }
-    }
-    
-    if(isEarth){
-        // Earth being shadowed by moon (solar eclipse)
-        vec3 sunToEarth = vWorldPos - sunPosition;
-        vec3 sunToMoon = moonPosition - sunPosition;
-        
-        float sunEarthDist = length(sunToEarth);
-        float sunMoonDist = length(sunToMoon);
-        
-        if(sunEarthDist > sunMoonDist){
-            vec3 sunToMoonNorm = normalize(sunToMoon);
-            float projectionLength = dot(sunToEarth, sunToMoonNorm);
-            vec3 closestPointOnLine = sunPosition + sunToMoonNorm * projectionLength;
-            
-            float distanceToLine = length(vWorldPos - closestPointOnLine);
-            
-            float shadowRadius = moonRadius * 2.0; // Moon casts smaller shadow
-            if(distanceToLine < shadowRadius){
-                float shadowStrength = 1.0 - (distanceToLine / shadowRadius);
-                moonShadow = shadowStrength * shadowStrength;
-            }
-        }
-    }
-
     vec3 ambient  = Ka * lightColor;
     vec3 diffuse  = Kd * lightColor * ndotl;
     vec3 R = reflect(-L,N);
@@ -215,31 +329,111 @@ void main(){
     vec3 specular = Ks * lightColor * specPow;
 
     // Apply shadows to diffuse and specular (keep some ambient)
-    float totalShadow = max(earthShadow, moonShadow);
+    float totalShadow = 0.0;
+#ifdef ECLIPSE_RECEIVER
+    totalShadow = eclipseShadow(worldPos);
+#endif
     vec3 lighting = ambient + (1.0 - totalShadow) * (diffuse + specular);
+    return base * lighting;
+#else
+    return base;
+#endif
+}
+)GLSL";
+
+const string FS_MAIN = string(SHADE_GLSL) + R"GLSL(
+in vec2 vUV;
+#ifdef LIT
+in vec3 vWorldPos;
+in vec3 vNormal;
+#endif
+out vec4 FragColor;
+
+void main(){
+#ifdef LIT
+    FragColor = vec4(shadeSurface(vUV, vWorldPos, normalize(vNormal)), 1.0);
+#else
+    FragColor = vec4(shadeSurface(vUV, vec3(0.0), vec3(0.0)), 1.0);
+#endif
+}
+)GLSL";
 
-    FragColor = vec4(base * lighting, 1.0);
+// Camera-facing quad around a sphere, generated from gl_VertexID (4-vertex strip, no vertex buffer).
+// The quad sits on the sphere's near side and covers its silhouette cone; FS_IMPOSTOR ray-casts the
+// analytic sphere, so per-body vertex cost stays constant no matter how many bodies are drawn.
+const char* VS_IMPOSTOR = R"GLSL(
+uniform mat4 worldMatrix; // unit sphere -> world, including the radius scale
+
+out vec3 vWorldPos;
+
+void main(){
+    vec3 center = worldMatrix[3].xyz;
+    float radius = length(worldMatrix[0].xyz);
+    vec3 toCenter = center - viewPos;
+    float d = max(length(toCenter), radius*1.001);
+    vec3 dir = toCenter / d;
+    vec3 right = normalize(cross(dir, abs(dir.y) < 0.99 ? vec3(0,1,0) : vec3(1,0,0)));
+    vec3 up = cross(right, dir);
+
+    float nearDist = d - radius;
+    float halfSize = nearDist * radius / sqrt(d*d - radius*radius); // silhouette cone at the quad's depth
+    vec2 corner = vec2(gl_VertexID & 1, gl_VertexID >> 1) * 2.0 - 1.0;
+    vWorldPos = viewPos + dir*nearDist + (corner.x*right + corner.y*up) * halfSize;
+    gl_Position = projectionMatrix * viewMatrix * vec4(vWorldPos,1.0);
 }
 )GLSL";
 
+const string FS_IMPOSTOR = string(SHADE_GLSL) + R"GLSL(
+uniform mat4 worldMatrix;
+
+in vec3 vWorldPos;
+out vec4 FragColor;
+
+void main(){
+    vec3 center = worldMatrix[3].xyz;
+    float radius = length(worldMatrix[0].xyz);
+    vec3 rd = normalize(vWorldPos - viewPos);
+    vec3 oc = viewPos - center;
+    float b = dot(oc, rd);
+    float h = b*b - (dot(oc,oc) - radius*radius);
+    if(h < 0.0) discard;
+    vec3 hit = viewPos + rd * (-b - sqrt(h));
+    vec3 N = (hit - center) / radius;
+
+    // Same parameterisation as buildIndexedSphere: pos = (sin t cos p, cos t, sin t sin p), uv = (p/2pi, t/pi).
+    // worldMatrix is rotation * radius, so its transpose over radius^2 takes the hit back to the unit sphere.
+    vec3 local = transpose(mat3(worldMatrix)) * (hit - center) / (radius*radius);
+    float phi = atan(local.z, local.x);
+    if(phi < 0.0) phi += 6.28318530718;
+    vec2 uv = vec2(phi / 6.28318530718, acos(clamp(local.y,-1.0,1.0)) / 3.14159265359);
+
+    vec4 clip = projectionMatrix * viewMatrix * vec4(hit,1.0);
+    gl_FragDepth = clip.z / clip.w * 0.5 + 0.5;
+    FragColor = vec4(shadeSurface(uv, hit, N), 1.0);
+}
+)GLSL";
+
+// Stars are StarVertex: an octahedral direction from the centre of the field, and colour plus brightness
 const char* VS_STAR = R"GLSL(
-#version 330 core
-layout(location=0) in vec3 aPos;
-layout(location=1) in vec3 aColor;
-layout(location=2) in float aBrightness;
-uniform mat4 viewMatrix;
-uniform mat4 projectionMatrix;
+layout(location=0) in vec2 aOctDir;
+layout(location=1) in vec4 aColorBrightness;
+uniform float starRadius;
 out vec3 starColor;
 out float starBrightness;
+vec3 octDecode(vec2 e){
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    float t = max(-n.z, 0.0);
+    n.xy += vec2(n.x >= 0.0 ? -t : t, n.y >= 0.0 ? -t : t);
+    return normalize(n);
+}
 void main(){
-    starColor = aColor;
-    starBrightness = aBrightness;
-    gl_Position = projectionMatrix * viewMatrix * vec4(aPos,1.0);
-    gl_PointSize = 1.5 + 3.0*aBrightness;
+    starColor = aColorBrightness.rgb;
+    starBrightness = aColorBrightness.a;
+    gl_Position = projectionMatrix * viewMatrix * vec4(octDecode(aOctDir)*starRadius, 1.0);
+    gl_PointSize = 1.5 + 3.0*starBrightness;
 }
 )GLSL";
 const char* FS_STAR = R"GLSL(
-#version 330 core
 in vec3 starColor;
 in float starBrightness;
 out vec4 FragColor;
@@ -253,116 +447,964 @@ void main(){
 }
 )GLSL";
 
+// Baked starfield: a fullscreen triangle at the far plane looking up the view direction in the cubemap
+const char* VS_SKYBOX = R"GLSL(
+out vec3 vDir;
+void main(){
+    vec2 p = vec2(gl_VertexID==1 ? 3.0 : -1.0, gl_VertexID==2 ? 3.0 : -1.0);
+    gl_Position = vec4(p, 1.0, 1.0);
+    vec4 eye = inverse(projectionMatrix) * vec4(p, 1.0, 1.0);
+    vDir = transpose(mat3(viewMatrix)) * (eye.xyz / eye.w);
+}
+)GLSL";
+const char* FS_SKYBOX = R"GLSL(
+uniform samplerCube stars;
+in vec3 vDir;
+out vec4 FragColor;
+void main(){ FragColor = vec4(texture(stars, vDir).rgb, 1.0); }
+)GLSL";
+
 const char* VS_SHOOT = R"GLSL(
-#version 330 core
 layout(location=0) in vec3 aPos;
-uniform mat4 viewMatrix;
-uniform mat4 projectionMatrix;
 void main(){
     gl_Position = projectionMatrix * viewMatrix * vec4(aPos,1.0);
 }
 )GLSL";
 const char* FS_SHOOT = R"GLSL(
-#version 330 core
 out vec4 FragColor;
 uniform vec3 starColor;
 uniform float alpha;
 void main(){ FragColor = vec4(starColor, alpha); }
 )GLSL";
 
-void setProjectionMatrix(int program, mat4 P){
-    glUseProgram(program);
-    glUniformMatrix4fv(glGetUniformLocation(program,"projectionMatrix"),1,GL_FALSE,&P[0][0]);
+// Uniform locations are resolved once right after linking; draw code only touches the cached GLints.
+// Every by-name lookup goes through lookupUniform so the per-frame counter can prove steady state does none.
+auto startupBegin = chrono::steady_clock::now();
+double msSinceStartup(){ return chrono::duration<double,milli>(chrono::steady_clock::now()-startupBegin).count(); }
+
+struct FrameStats { int uniformLookups=0, glCallsIssued=0, glCallsSkipped=0, impostors=0; long long triangles=0, stars=0; float textureMB=-1; };
+FrameStats frameStats;
+bool showFrameStats = false;
+
+GLint lookupUniform(GLuint program, const char* name){
+    ++frameStats.uniformLookups;
+    return glGetUniformLocation(program,name);
 }
-void setViewMatrix(int program, mat4 V){
-    glUseProgram(program);
-    glUniformMatrix4fv(glGetUniformLocation(program,"viewMatrix"),1,GL_FALSE,&V[0][0]);
+
+// View, projection and lighting live in the FrameData block, so the tables only hold per-draw uniforms.
+// Uniforms a variant compiled out resolve to -1, and glState drops writes to them.
+struct MainUniforms {
+    GLuint program=0;
+    GLint worldMatrix, texture1, textureLayer, useTexture, tint, Ka, Kd, Ks, shininess, occluderPosition, shadowRadius, sphereTess;
+    void resolve(GLuint p){
+        program=p;
+        worldMatrix=lookupUniform(p,"worldMatrix");     sphereTess=lookupUniform(p,"sphereTess");
+        texture1=lookupUniform(p,"texture1");       useTexture=lookupUniform(p,"useTexture");
+        tint=lookupUniform(p,"tint");               textureLayer=lookupUniform(p,"textureLayer");
+        Ka=lookupUniform(p,"Ka"); Kd=lookupUniform(p,"Kd"); Ks=lookupUniform(p,"Ks");
+        shininess=lookupUniform(p,"shininess");
+        occluderPosition=lookupUniform(p,"occluderPosition"); shadowRadius=lookupUniform(p,"shadowRadius");
+    }
+};
+struct StarUniforms {
+    GLuint program=0;
+    GLint starRadius;
+    void resolve(GLuint p){ program=p; starRadius=lookupUniform(p,"starRadius"); }
+};
+struct ShootUniforms {
+    GLuint program=0;
+    GLint starColor, alpha;
+    void resolve(GLuint p){
+        program=p;
+        starColor=lookupUniform(p,"starColor"); alpha=lookupUniform(p,"alpha");
+    }
+};
+
+void reportFrameStats(float t){
+    static int frame = 0;
+    static float lastReport = 0.0f;
+    if(frame++>0 && frameStats.uniformLookups>0)
+        cerr<<"Warning: "<<frameStats.uniformLookups<<" uniform lookups by name in frame "<<frame<<"\n";
+    if(showFrameStats && t-lastReport>=2.0f){
+        cout<<"[stats] uniform lookups/frame="<<frameStats.uniformLookups
+            <<" state calls issued="<<frameStats.glCallsIssued<<" skipped="<<frameStats.glCallsSkipped
+            <<" triangles="<<frameStats.triangles<<" impostors="<<frameStats.impostors<<" stars="<<frameStats.stars;
+        if(frameStats.textureMB>=0) cout<<" resident texture MB="<<frameStats.textureMB;
+        cout<<"\n";
+        lastReport = t;
+    }
+    frameStats = FrameStats();
+}
+
+void createFrameDataUBO(){
+    glGenBuffers(1,&frameUBO);
+    glBindBuffer(GL_UNIFORM_BUFFER,frameUBO);
+    glBufferData(GL_UNIFORM_BUFFER,sizeof(FrameData),nullptr,GL_DYNAMIC_DRAW);
+    glBindBufferBase(GL_UNIFORM_BUFFER,FRAME_DATA_BINDING,frameUBO);
 }
-void setWorldMatrix(int program, mat4 M){
-    glUseProgram(program);
-    glUniformMatrix4fv(glGetUniformLocation(program,"worldMatrix"),1,GL_FALSE,&M[0][0]);
+void updateFrameData(const FrameData& fd){
+    glBindBuffer(GL_UNIFORM_BUFFER,frameUBO);
+    glBufferSubData(GL_UNIFORM_BUFFER,0,sizeof(FrameData),&fd);
+}
+// The draw path goes through glState, which remembers what is bound and the last value written to each
+// uniform and drops calls that would change nothing. Code outside the draw path that binds programs,
+// VAOs or textures directly must call invalidateBindings() afterwards.
+struct GLStateCache {
+    static const int MAX_UNITS = 16;
+    struct UniformValue { float v[16]; int n=0; };
+    GLuint program=0, vao=0;
+    GLenum activeUnit=GL_TEXTURE0;
+    GLenum unitTarget[MAX_UNITS]={}; GLuint unitTexture[MAX_UNITS]={};
+    unordered_map<uint64_t,UniformValue> uniforms; // keyed by program<<32 | location
+
+    bool changed(bool c){ if(c) ++frameStats.glCallsIssued; else ++frameStats.glCallsSkipped; return c; }
+    void invalidateBindings(){
+        program=0; vao=0; activeUnit=GL_TEXTURE0; glActiveTexture(GL_TEXTURE0);
+        for(int i=0;i<MAX_UNITS;++i){ unitTarget[i]=0; unitTexture[i]=0; }
+    }
+    void useProgram(GLuint p){ if(changed(p!=program)){ program=p; glUseProgram(p); } }
+    void bindVertexArray(GLuint v){ if(changed(v!=vao)){ vao=v; glBindVertexArray(v); } }
+    void bindTexture(int unit, GLenum target, GLuint tex){
+        if(!changed(unitTarget[unit]!=target || unitTexture[unit]!=tex)) return;
+        GLenum u = GL_TEXTURE0+(GLenum)unit;
+        if(activeUnit!=u){ activeUnit=u; glActiveTexture(u); }
+        unitTarget[unit]=target; unitTexture[unit]=tex;
+        glBindTexture(target,tex);
+    }
+    // Returns true when the value differs from the cached one for the current program. Locations the
+    // program does not have are neither issued nor counted, so glCallsSkipped only counts cache hits.
+    bool store(GLint loc, const float* v, int n){
+        if(loc<0) return false;
+        UniformValue& u = uniforms[((uint64_t)program<<32)|(uint32_t)loc];
+        if(!changed(u.n!=n || memcmp(u.v,v,n*sizeof(float))!=0)) return false;
+        u.n=n; memcpy(u.v,v,n*sizeof(float));
+        return true;
+    }
+    void uniform1i(GLint loc, int x){ float v=(float)x; if(store(loc,&v,1)) glUniform1i(loc,x); }
+    void uniform1f(GLint loc, float x){ if(store(loc,&x,1)) glUniform1f(loc,x); }
+    void uniform2i(GLint loc, int x, int y){ float v[2]={(float)x,(float)y}; if(store(loc,v,2)) glUniform2i(loc,x,y); }
+    void uniform3f(GLint loc, float x, float y, float z){ float v[3]={x,y,z}; if(store(loc,v,3)) glUniform3f(loc,x,y,z); }
+    void uniformMatrix4(GLint loc, const mat4& M){ if(store(loc,&M[0][0],16)) glUniformMatrix4fv(loc,1,GL_FALSE,&M[0][0]); }
+};
+GLStateCache glState;
+
+void setWorldMatrix(const MainUniforms& u, mat4 M){
+    glState.useProgram(u.program);
+    glState.uniformMatrix4(u.worldMatrix,M);
 }
 
-struct VertexPTN{ vec3 p; vec3 c; vec2 uv; vec3 n; };
+struct VertexPTN{ vec3 p; vec2 uv; vec3 n; };
+
+// Opt-in compact layout (--packed-vertices): half-float position and UV, octahedral normal in two snorm16s.
+// 16 bytes instead of 32. VS_MAIN decodes it when compiled with PACKED_VERTEX.
+bool usePackedVertices = false;
+struct VertexPacked{ uint16_t p[4]; uint16_t uv[2]; int16_t n[2]; };
+
+float signNotZero(float v){ return v>=0.0f ? 1.0f : -1.0f; }
+vec2 octEncode(vec3 n){
+    n /= (fabs(n.x)+fabs(n.y)+fabs(n.z));
+    if(n.z>=0.0f) return vec2(n.x,n.y);
+    return vec2((1.0f-fabs(n.y))*signNotZero(n.x), (1.0f-fabs(n.x))*signNotZero(n.y));
+}
+int16_t packSnorm16(float v){ return (int16_t)lround(glm::clamp(v,-1.0f,1.0f)*32767.0f); }
+VertexPacked packVertex(const VertexPTN& v){
+    VertexPacked o;
+    o.p[0]=packHalf1x16(v.p.x); o.p[1]=packHalf1x16(v.p.y); o.p[2]=packHalf1x16(v.p.z); o.p[3]=0;
+    o.uv[0]=packHalf1x16(v.uv.x); o.uv[1]=packHalf1x16(v.uv.y);
+    vec2 e = octEncode(v.n);
+    o.n[0]=packSnorm16(e.x); o.n[1]=packSnorm16(e.y);
+    return o;
+}
+size_t vertexStride(){ return usePackedVertices ? sizeof(VertexPacked) : sizeof(VertexPTN); }
+
+// One detail level of a Mesh: a range of its index buffer over the shared vertex buffer, and the
+// simplifier's worst-case deviation from the full mesh in model units.
+struct MeshLod { unsigned firstIndex, indexCount; float error; };
+
 struct Mesh {
     vector<VertexPTN> vertices;
     vector<unsigned>  indices;
+    GLenum indexType=GL_UNSIGNED_INT;   // GL_UNSIGNED_SHORT uploads the indices as 16-bit
     GLuint VAO=0,VBO=0,EBO=0;
+    GLsizei indexCount=0;
+    vector<MeshLod> lods;               // index ranges of the detail levels; empty means the whole buffer is level 0
+    float boundRadius=0.0f;             // around the model origin, for picking a level from projected size
+    // Vertex and index bytes exactly as they go into the buffers
+    vector<uint8_t> vertexData() const {
+        vector<uint8_t> bytes(vertices.size()*vertexStride());
+        if(usePackedVertices){
+            VertexPacked* dst = (VertexPacked*)bytes.data();
+            for(const VertexPTN& v: vertices) *dst++ = packVertex(v);
+        }
+        else if(!vertices.empty()) memcpy(bytes.data(),vertices.data(),bytes.size());
+        return bytes;
+    }
+    vector<uint8_t> indexData() const {
+        vector<uint8_t> bytes(indexBytes());
+        if(indexType==GL_UNSIGNED_SHORT){
+            uint16_t* dst = (uint16_t*)bytes.data();
+            for(unsigned i: indices) *dst++ = (uint16_t)i;
+        }
+        else if(!indices.empty()) memcpy(bytes.data(),indices.data(),bytes.size());
+        return bytes;
+    }
     void upload(){
+        vector<uint8_t> v = vertexData(), i = indexData();
+        uploadBytes(v.data(),v.size(),i.data(),i.size());
+    }
+    // Fills the buffers from data already in the current vertex format and indexType, e.g. a mapped mesh cache
+    void uploadBytes(const void* vertexBytes, size_t vertexSize, const void* indexBytes, size_t indexSize){
         if(VAO==0){ glGenVertexArrays(1,&VAO); glGenBuffers(1,&VBO); glGenBuffers(1,&EBO);}
         glBindVertexArray(VAO);
         glBindBuffer(GL_ARRAY_BUFFER,VBO);
-        glBufferData(GL_ARRAY_BUFFER,vertices.size()*sizeof(VertexPTN),vertices.data(),GL_STATIC_DRAW);
+        glBufferData(GL_ARRAY_BUFFER,vertexSize,vertexBytes,GL_STATIC_DRAW);
         glBindBuffer(GL_ELEMENT_ARRAY_BUFFER,EBO);
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER,indices.size()*sizeof(unsigned),indices.data(),GL_STATIC_DRAW);
-        glVertexAttribPointer(0,3,GL_FLOAT,GL_FALSE,sizeof(VertexPTN),(void*)offsetof(VertexPTN,p)); glEnableVertexAttribArray(0);
-        glVertexAttribPointer(1,3,GL_FLOAT,GL_FALSE,sizeof(VertexPTN),(void*)offsetof(VertexPTN,c)); glEnableVertexAttribArray(1);
-        glVertexAttribPointer(2,2,GL_FLOAT,GL_FALSE,sizeof(VertexPTN),(void*)offsetof(VertexPTN,uv)); glEnableVertexAttribArray(2);
-        glVertexAttribPointer(3,3,GL_FLOAT,GL_FALSE,sizeof(VertexPTN),(void*)offsetof(VertexPTN,n)); glEnableVertexAttribArray(3);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER,indexSize,indexBytes,GL_STATIC_DRAW);
+        indexCount=(GLsizei)(indexSize/(indexType==GL_UNSIGNED_SHORT ? sizeof(uint16_t) : sizeof(unsigned)));
+        if(usePackedVertices){
+            glVertexAttribPointer(0,3,GL_HALF_FLOAT,GL_FALSE,sizeof(VertexPacked),(void*)offsetof(VertexPacked,p)); glEnableVertexAttribArray(0);
+            glVertexAttribPointer(2,2,GL_HALF_FLOAT,GL_FALSE,sizeof(VertexPacked),(void*)offsetof(VertexPacked,uv)); glEnableVertexAttribArray(2);
+            glVertexAttribPointer(3,2,GL_SHORT,GL_TRUE,sizeof(VertexPacked),(void*)offsetof(VertexPacked,n)); glEnableVertexAttribArray(3);
+        }else{
+            glVertexAttribPointer(0,3,GL_FLOAT,GL_FALSE,sizeof(VertexPTN),(void*)offsetof(VertexPTN,p)); glEnableVertexAttribArray(0);
+            glVertexAttribPointer(2,2,GL_FLOAT,GL_FALSE,sizeof(VertexPTN),(void*)offsetof(VertexPTN,uv)); glEnableVertexAttribArray(2);
+            glVertexAttribPointer(3,3,GL_FLOAT,GL_FALSE,sizeof(VertexPTN),(void*)offsetof(VertexPTN,n)); glEnableVertexAttribArray(3);
+        }
         glBindVertexArray(0);
     }
-    void drawElements(){ glBindVertexArray(VAO); glDrawElements(GL_TRIANGLES,(GLsizei)indices.size(),GL_UNSIGNED_INT,0); }
+    void release(){
+        if(VAO){ glDeleteVertexArrays(1,&VAO); glDeleteBuffers(1,&VBO); glDeleteBuffers(1,&EBO); }
+        VAO=VBO=EBO=0; indexCount=0;
+    }
+    size_t vertexBytes() const { return vertices.size()*vertexStride(); }
+    size_t indexBytes() const { return indices.size()*(indexType==GL_UNSIGNED_SHORT ? sizeof(uint16_t) : sizeof(unsigned)); }
+    int lodCount() const { return lods.empty() ? 1 : (int)lods.size(); }
+    void drawElements(int lod=0) const {
+        GLsizei first = 0, count = indexCount;
+        if(!lods.empty()){
+            const MeshLod& l = lods[glm::clamp(lod,0,(int)lods.size()-1)];
+            first = (GLsizei)l.firstIndex; count = (GLsizei)l.indexCount;
+        }
+        size_t indexSize = indexType==GL_UNSIGNED_SHORT ? sizeof(uint16_t) : sizeof(unsigned);
+        glState.bindVertexArray(VAO); glDrawElements(GL_TRIANGLES,count,indexType,(void*)(first*indexSize));
+        frameStats.triangles += count/3;
+    }
 };
 
-bool loadOBJ(const string& path, Mesh& out, vec3 defaultColor=vec3(0.8f)){
-    ifstream f(path);
-    if(!f.good()){ cout<<"OBJ not found: "<<path<<" (will use fallback)\n"; return false; }
-    vector<vec3> P; vector<vec2> T; vector<vec3> N;
-    vector<unsigned> ip,it,in;
-    string line;
-    while(getline(f,line)){
-        if(line.size()<2) continue;
-        istringstream ss(line);
-        string tag; ss>>tag;
-        if(tag=="v"){ vec3 p; ss>>p.x>>p.y>>p.z; P.push_back(p); }
-        else if(tag=="vt"){ vec2 t; ss>>t.x>>t.y; T.push_back(t); }
-        else if(tag=="vn"){ vec3 n; ss>>n.x>>n.y>>n.z; N.push_back(n); }
-        else if(tag=="f"){
-            vector<string> toks; string tok; while(ss>>tok) toks.push_back(tok);
-            auto parseV = [&](const string& s, int& vi,int& ti,int& ni){
-                vi=ti=ni=0;
-                sscanf(s.c_str(), "%d/%d/%d", &vi, &ti, &ni);
-                if(vi<0) vi = (int)P.size()+1+vi;
-                if(ti<0) ti = (int)T.size()+1+ti;
-                if(ni<0) ni = (int)N.size()+1+ni;
-            };
-            for(size_t k=1;k+1<toks.size();++k){
-                int i0, t0, n0, i1,t1,n1, i2,t2,n2;
-                parseV(toks[0], i0,t0,n0);
-                parseV(toks[k], i1,t1,n1);
-                parseV(toks[k+1], i2,t2,n2);
-                ip.insert(ip.end(),{(unsigned)i0,(unsigned)i1,(unsigned)i2});
-                it.insert(it.end(),{(unsigned)t0,(unsigned)t1,(unsigned)t2});
-                in.insert(in.end(),{(unsigned)n0,(unsigned)n1,(unsigned)n2});
+// Memory of a mesh in the current vertex format next to the float layout, plus the vertex fetch per draw
+void reportVertexFormat(const char* name, const Mesh& m, size_t vsInvocations){
+    size_t floatBytes = m.vertices.size()*sizeof(VertexPTN), packedBytes = m.vertices.size()*sizeof(VertexPacked);
+    printf("%s: %zu vertices, %s format, vertex buffer %.1f KB (float %.1f KB, packed %.1f KB), "
+           "vertex fetch %.1f KB/draw\n", name, m.vertices.size(), usePackedVertices ? "packed" : "float",
+           m.vertexBytes()/1024.0, floatBytes/1024.0, packedBytes/1024.0, vsInvocations*vertexStride()/1024.0);
+}
+
+// Vertex shader invocations for an index stream run through a FIFO post-transform cache
+size_t simulateVertexCache(const vector<unsigned>& indices, int cacheSize=32){
+    vector<long long> fifo(cacheSize,-1); size_t head=0, misses=0;
+    for(unsigned i: indices){
+        if(find(fifo.begin(),fifo.end(),(long long)i)!=fifo.end()) continue;
+        fifo[head]=i; head=(head+1)%cacheSize; ++misses;
+    }
+    return misses;
+}
+
+// Average cache miss ratio: post-transform cache misses per triangle (0.5 is the limit for large regular meshes)
+double meshACMR(const vector<unsigned>& indices){
+    return indices.empty() ? 0.0 : (double)simulateVertexCache(indices)/(indices.size()/3);
+}
+
+// Tipsify (Sander, Nehab, Barczak 2007): fans triangles around a vertex, then moves to the neighbour that is
+// still in a cache of cacheSize entries, or back along a dead-end stack when none is. Each dead-end jump
+// starts a new cluster; clusters are then ordered outward-facing first to cut overdraw from the mesh itself.
+// Returns the new triangle order as indices.
+vector<unsigned> tipsify(const vector<unsigned>& indices, const vector<VertexPTN>& vertices, int cacheSize=24){
+    size_t triCount = indices.size()/3, vertCount = vertices.size();
+    vector<unsigned> adjStart(vertCount+1,0), adj(indices.size());
+    for(unsigned v: indices) ++adjStart[v+1];
+    for(size_t v=0;v<vertCount;++v) adjStart[v+1] += adjStart[v];
+    vector<unsigned> fill(adjStart.begin(),adjStart.end()-1);
+    for(size_t i=0;i<indices.size();++i) adj[fill[indices[i]]++] = (unsigned)(i/3);
+    vector<int> live(vertCount), cacheTime(vertCount,0);
+    for(size_t v=0;v<vertCount;++v) live[v] = (int)(adjStart[v+1]-adjStart[v]);
+    vector<char> emitted(triCount,0);
+    vector<unsigned> deadEnd, candidates, order; order.reserve(triCount);
+    vector<size_t> clusterStart;
+    int stamp = cacheSize+1; size_t cursor = 0;
+    long long f = 0;
+    bool jumped = true;
+    while(f>=0){
+        candidates.clear();
+        for(unsigned a=adjStart[f]; a<adjStart[f+1]; ++a){
+            unsigned t = adj[a];
+            if(emitted[t]) continue;
+            if(jumped){ clusterStart.push_back(order.size()); jumped = false; }
+            for(int k=0;k<3;++k){
+                unsigned v = indices[t*3+k];
+                deadEnd.push_back(v); candidates.push_back(v); --live[v];
+                if(stamp-cacheTime[v] > cacheSize) cacheTime[v] = stamp++;
             }
+            emitted[t] = 1; order.push_back(t);
+        }
+        // Next fanning vertex: the candidate with live triangles whose fan would still hit the cache, oldest first
+        long long next = -1; int best = -1;
+        for(unsigned v: candidates){
+            if(live[v]<=0) continue;
+            int p = 0;
+            if(stamp-cacheTime[v]+2*live[v] <= cacheSize) p = stamp-cacheTime[v];
+            if(p>best){ best = p; next = v; }
         }
+        if(next<0){
+            jumped = true;
+            while(!deadEnd.empty() && next<0){ unsigned d = deadEnd.back(); deadEnd.pop_back(); if(live[d]>0) next = d; }
+            while(next<0 && cursor<vertCount){ if(live[cursor]>0) next = (long long)cursor; ++cursor; }
+        }
+        f = next;
+    }
+    clusterStart.push_back(order.size());
+
+    // Overdraw: sort clusters by how far their average normal points away from the mesh centre
+    vec3 meshCentre(0.0f);
+    for(const VertexPTN& v: vertices) meshCentre += v.p;
+    if(vertCount) meshCentre /= (float)vertCount;
+    size_t clusterCount = clusterStart.size()-1;
+    vector<pair<float,size_t>> clusters(clusterCount);
+    for(size_t c=0;c<clusterCount;++c){
+        vec3 centre(0.0f), normal(0.0f); float area = 0.0f;
+        for(size_t o=clusterStart[c]; o<clusterStart[c+1]; ++o){
+            const unsigned* t = &indices[order[o]*3];
+            vec3 a = vertices[t[0]].p, b = vertices[t[1]].p, d = vertices[t[2]].p;
+            vec3 n = cross(b-a, d-a); float ar = length(n);
+            centre += (a+b+d)*(ar/3.0f); normal += n; area += ar;
+        }
+        if(area>0.0f) centre /= area;
+        clusters[c] = { -dot(centre-meshCentre, normal), c };
+    }
+    stable_sort(clusters.begin(), clusters.end());
+    vector<unsigned> out; out.reserve(indices.size());
+    for(auto& c: clusters)
+        for(size_t o=clusterStart[c.second]; o<clusterStart[c.second+1]; ++o)
+            out.insert(out.end(), { indices[order[o]*3], indices[order[o]*3+1], indices[order[o]*3+2] });
+    return out;
+}
+
+// Post-load optimisation of an indexed mesh: Tipsify triangle order (kept only if it beats the original),
+// then vertices renumbered in first-use order so fetches walk the vertex buffer forwards.
+// Unreferenced vertices are dropped. The cache target is a little under the simulated FIFO of 32.
+bool meshOptimizeEnabled = true;
+void optimizeMesh(Mesh& m, const char* name=nullptr){
+    if(!meshOptimizeEnabled || m.indices.size()<3) return;
+    double before = meshACMR(m.indices);
+    vector<unsigned> tris = tipsify(m.indices, m.vertices);
+    if(meshACMR(tris) >= before) tris = m.indices;
+    vector<unsigned> remap(m.vertices.size(), ~0u);
+    vector<VertexPTN> verts; verts.reserve(m.vertices.size());
+    for(unsigned& i: tris){
+        if(remap[i]==~0u){ remap[i] = (unsigned)verts.size(); verts.push_back(m.vertices[i]); }
+        i = remap[i];
+    }
+    m.vertices.swap(verts); m.indices.swap(tris);
+    if(name) printf("%s: vertex cache ACMR %.3f -> %.3f (FIFO 32, at best %.3f)\n", name, before, meshACMR(m.indices),
+                    (double)m.vertices.size()/(m.indices.size()/3));
+}
+
+// Symmetric 4x4 quadric of squared distances to a set of planes (Garland & Heckbert), upper triangle
+struct Quadric {
+    double q[10] = {};
+    void addPlane(vec3 n, float d, double w){
+        double a=n.x, b=n.y, c=n.z, e=d;
+        q[0]+=w*a*a; q[1]+=w*a*b; q[2]+=w*a*c; q[3]+=w*a*e; q[4]+=w*b*b;
+        q[5]+=w*b*c; q[6]+=w*b*e; q[7]+=w*c*c; q[8]+=w*c*e; q[9]+=w*e*e;
     }
+    void add(const Quadric& o){ for(int i=0;i<10;++i) q[i]+=o.q[i]; }
+    double error(vec3 p) const {
+        double x=p.x, y=p.y, z=p.z;
+        return q[0]*x*x + 2*q[1]*x*y + 2*q[2]*x*z + 2*q[3]*x + q[4]*y*y + 2*q[5]*y*z + 2*q[6]*y
+             + q[7]*z*z + 2*q[8]*z + q[9];
+    }
+};
+
+// Builds coarser levels of m by quadric-error edge collapses, each level roughly half the triangles of the
+// previous one. Topology and quadrics work on welded positions, since OBJ exports split vertices wherever
+// the normal or UV changes. A collapse moves one position onto a neighbouring one and points each of its
+// vertices at the target's vertex with the closest normal, so every level indexes the same vertex buffer
+// and the levels are appended to m.indices. Open borders only slide along themselves.
+// Runs after optimizeMesh, and Tipsify orders each new level.
+const int MESH_LOD_LEVELS = 4;
+const float MESH_LOD_ERROR_PX = 1.0f; // allowed on-screen deviation when picking a level
+void buildMeshLods(Mesh& m, const char* name=nullptr){
+    size_t n = m.vertices.size();
+    m.boundRadius = 0.0f;
+    for(const VertexPTN& v: m.vertices) m.boundRadius = std::max(m.boundRadius, length(v.p));
+    m.lods.assign(1, MeshLod{0, (unsigned)m.indices.size(), 0.0f});
+    if(m.indices.size()<3*64) return;
+
+    // Weld: pos[v] is the first vertex with v's position; wedges lists the vertices of each welded position
+    vector<unsigned> pos(n), wedgeStart(n+1,0), wedges(n);
+    {
+        unordered_map<uint64_t,unsigned> first;
+        for(size_t v=0;v<n;++v){
+            uint32_t k[3]; memcpy(k,&m.vertices[v].p,12);
+            pos[v] = first.emplace(fnv1a(k,12),(unsigned)v).first->second;
+            ++wedgeStart[pos[v]+1];
+        }
+        for(size_t v=0;v<n;++v) wedgeStart[v+1] += wedgeStart[v];
+        vector<unsigned> cursor(wedgeStart.begin(), wedgeStart.end()-1);
+        for(size_t v=0;v<n;++v) wedges[cursor[pos[v]]++] = (unsigned)v;
+    }
+    auto P = [&](unsigned v){ return m.vertices[v].p; };
+    auto edgeKey = [](unsigned a, unsigned b){ return a<b ? (uint64_t)a<<32|b : (uint64_t)b<<32|a; };
+    auto countEdges = [&](const vector<unsigned>& idx, unordered_map<uint64_t,int>& edgeUse){
+        edgeUse.clear();
+        for(size_t i=0;i<idx.size();i+=3) for(int k=0;k<3;++k) ++edgeUse[edgeKey(pos[idx[i+k]],pos[idx[i+(k+1)%3]])];
+    };
+
+    vector<unsigned> idx(m.indices.begin(), m.indices.end());
+    unordered_map<uint64_t,int> edgeUse;
+    countEdges(idx, edgeUse);
+    vector<Quadric> Q(n);
+    vector<double> weight(n,0.0);
+    for(size_t i=0;i<idx.size();i+=3){
+        unsigned t[3] = { pos[idx[i]], pos[idx[i+1]], pos[idx[i+2]] };
+        vec3 c = cross(P(t[1])-P(t[0]), P(t[2])-P(t[0]));
+        if(length(c)<=0.0f) continue;
+        vec3 nrm = normalize(c);
+        for(int k=0;k<3;++k){ Q[t[k]].addPlane(nrm, -dot(nrm,P(t[0])), 1.0); weight[t[k]] += 1.0; }
+        // Borders get a stiff plane through the edge at right angles to the face, so they keep their outline
+        for(int k=0;k<3;++k){
+            unsigned a = t[k], b = t[(k+1)%3];
+            vec3 e = P(b)-P(a);
+            if(edgeUse[edgeKey(a,b)]!=1 || length(e)<=0.0f) continue;
+            vec3 side = normalize(cross(e,nrm));
+            Quadric bq; bq.addPlane(side, -dot(side,P(a)), 10.0);
+            Q[a].add(bq); Q[b].add(bq);
+        }
+    }
+
+    struct Collapse { double cost; unsigned from, to; bool operator<(const Collapse& o) const { return cost<o.cost; } };
+    vector<Collapse> candidates;
+    vector<unsigned> adjStart(n+1), adj, remap(n);
+    vector<char> touched(n), border(n);
+    double maxCost = 0.0;
+    size_t target = idx.size()/3/2;
+    while((int)m.lods.size()<MESH_LOD_LEVELS && target>=32){
+        countEdges(idx, edgeUse);
+        fill(border.begin(), border.end(), 0);
+        for(auto& e: edgeUse) if(e.second==1){ border[e.first>>32] = 1; border[(unsigned)e.first] = 1; }
+        fill(adjStart.begin(), adjStart.end(), 0);
+        for(unsigned v: idx) ++adjStart[pos[v]+1];
+        for(size_t v=0;v<n;++v) adjStart[v+1] += adjStart[v];
+        adj.resize(idx.size());
+        vector<unsigned> cursor(adjStart.begin(), adjStart.end()-1);
+        for(size_t i=0;i<idx.size();++i) adj[cursor[pos[idx[i]]]++] = (unsigned)(i/3);
+
+        // Cost of moving a onto b, as mean squared distance to the planes a and b have absorbed
+        candidates.clear();
+        for(auto& e: edgeUse){
+            unsigned ends[2] = { (unsigned)(e.first>>32), (unsigned)e.first };
+            for(int d=0;d<2;++d){
+                unsigned a = ends[d], b = ends[1-d];
+                if(border[a] && e.second!=1) continue;
+                Quadric q = Q[a]; q.add(Q[b]);
+                candidates.push_back({ std::max(0.0,q.error(P(b)))/std::max(1.0,weight[a]+weight[b]), a, b });
+            }
+        }
+        sort(candidates.begin(), candidates.end());
+
+        // Apply the cheapest collapses whose neighbourhoods do not overlap and that flip no triangle
+        for(size_t v=0;v<n;++v) remap[v] = (unsigned)v;
+        fill(touched.begin(), touched.end(), 0);
+        size_t tris = idx.size()/3, removed = 0, applied = 0;
+        for(const Collapse& c: candidates){
+            if(tris-removed<=target) break;
+            if(touched[c.from] || touched[c.to]) continue;
+            bool flips = false; size_t shared = 0;
+            for(unsigned a=adjStart[c.from]; a<adjStart[c.from+1] && !flips; ++a){
+                unsigned t[3] = { pos[idx[adj[a]*3]], pos[idx[adj[a]*3+1]], pos[idx[adj[a]*3+2]] };
+                if(t[0]==c.to || t[1]==c.to || t[2]==c.to){ ++shared; continue; }
+                vec3 p[3], q[3];
+                for(int k=0;k<3;++k){ p[k] = P(t[k]); q[k] = t[k]==c.from ? P(c.to) : p[k]; }
+                flips = dot(cross(p[1]-p[0],p[2]-p[0]), cross(q[1]-q[0],q[2]-q[0])) <= 0.0f;
+            }
+            if(flips) continue;
+            remap[c.from] = c.to; Q[c.to].add(Q[c.from]); weight[c.to] += weight[c.from];
+            for(unsigned v: { c.from, c.to })
+                for(unsigned a=adjStart[v]; a<adjStart[v+1]; ++a)
+                    for(int k=0;k<3;++k) touched[pos[idx[adj[a]*3+k]]] = 1;
+            maxCost = std::max(maxCost, c.cost);
+            removed += shared; ++applied;
+        }
+        // Rewrite the triangles: moved corners take the target's vertex with the nearest normal
+        size_t out = 0;
+        for(size_t i=0;i<idx.size();i+=3){
+            unsigned t[3];
+            for(int k=0;k<3;++k){
+                unsigned v = idx[i+k], to = remap[pos[v]];
+                if(to!=pos[v]){
+                    float best = -2.0f;
+                    for(unsigned w=wedgeStart[to]; w<wedgeStart[to+1]; ++w){
+                        float d = dot(m.vertices[wedges[w]].n, m.vertices[v].n);
+                        if(d>best){ best = d; t[k] = wedges[w]; }
+                    }
+                }
+                else t[k] = v;
+            }
+            if(pos[t[0]]==pos[t[1]] || pos[t[1]]==pos[t[2]] || pos[t[0]]==pos[t[2]]) continue;
+            idx[out++] = t[0]; idx[out++] = t[1]; idx[out++] = t[2];
+        }
+        idx.resize(out);
+        bool stuck = applied==0;
+        if(idx.size()/3<=target || stuck){
+            if(idx.size() >= m.lods.back().indexCount) break; // nothing left to remove
+            vector<unsigned> ordered = tipsify(idx, m.vertices);
+            m.lods.push_back(MeshLod{ (unsigned)m.indices.size(), (unsigned)ordered.size(), (float)sqrt(maxCost) });
+            m.indices.insert(m.indices.end(), ordered.begin(), ordered.end());
+            target = idx.size()/3/2;
+            if(stuck) break;
+        }
+    }
+    if(name){
+        printf("%s LODs:", name);
+        for(const MeshLod& l: m.lods) printf(" %u tris (err %.4f)", l.indexCount/3, l.error);
+        printf("\n");
+    }
+}
+
+
+// Phong coefficients for the lit variants
+struct Material { vec3 Ka, Kd, Ks; float shininess; };
+const Material BODY_MATERIAL = { vec3(0.05f), vec3(0.9f), vec3(0.2f), 32.0f };
+const Material SHIP_MATERIAL = { vec3(0.08f,0.08f,0.10f), vec3(0.95f,0.95f,1.0f), vec3(0.6f,0.6f,0.8f), 64.0f };
+
+// How a draw item gets its geometry; each path has its own set of MainVariant programs.
+// Impostors ray-cast the sphere on a camera-facing quad, world gives centre and radius.
+enum DrawPath { PATH_MESH, PATH_PROCEDURAL_SPHERE, PATH_IMPOSTOR, DRAW_PATH_COUNT };
+
+// One main-program draw; the frame collects these and submits them grouped by path, variant, then texture.
+struct DrawItem {
+    MainVariant variant;
+    GLuint texture=0;                   // 0 draws with the tint colour
+    int layer=-1;                       // layer of texture when it is the body texture array
+    vec3 tint=vec3(1);
+    GLuint vao=0; GLenum mode=GL_TRIANGLES; GLsizei count=0;
+    const Mesh* mesh=nullptr;           // indexed meshes draw through Mesh::drawElements instead
+    int meshLod=0;
+    DrawPath path=PATH_MESH;
+    int sphereTess[2]={0,0};            // segments, rings of a PATH_PROCEDURAL_SPHERE draw
+    mat4 world=mat4(1);
+    Material material=BODY_MATERIAL;
+    vec3 occluderPosition=vec3(0); float shadowRadius=0.0f;
+};
+
+GLuint emptyVAO = 0; // bound for the paths that build their vertices from gl_VertexID
+
+void submitDraws(vector<DrawItem>& items, const MainUniforms (*programs)[MAIN_VARIANT_COUNT]){
+    stable_sort(items.begin(),items.end(),[](const DrawItem& a, const DrawItem& b){
+        if(a.path!=b.path) return a.path<b.path;
+        return a.variant!=b.variant ? a.variant<b.variant : a.texture<b.texture;
+    });
+    for(const DrawItem& d: items){
+        const MainUniforms& u = programs[d.path][d.variant];
+        setWorldMatrix(u, d.world);
+        glState.uniform1i(u.useTexture, d.texture ? 1 : 0);
+        if(d.texture) glState.bindTexture(0, d.layer>=0 ? GL_TEXTURE_2D_ARRAY : GL_TEXTURE_2D, d.texture);
+        else glState.uniform3f(u.tint, d.tint.x, d.tint.y, d.tint.z);
+        if(d.layer>=0) glState.uniform1f(u.textureLayer, (float)d.layer);
+        glState.uniform3f(u.Ka, d.material.Ka.x, d.material.Ka.y, d.material.Ka.z);
+        glState.uniform3f(u.Kd, d.material.Kd.x, d.material.Kd.y, d.material.Kd.z);
+        glState.uniform3f(u.Ks, d.material.Ks.x, d.material.Ks.y, d.material.Ks.z);
+        glState.uniform1f(u.shininess, d.material.shininess);
+        glState.uniform3f(u.occluderPosition, d.occluderPosition.x, d.occluderPosition.y, d.occluderPosition.z);
+        glState.uniform1f(u.shadowRadius, d.shadowRadius);
+        if(d.path==PATH_IMPOSTOR){
+            glState.bindVertexArray(emptyVAO); glDrawArrays(GL_TRIANGLE_STRIP,0,4);
+            frameStats.triangles += 2; ++frameStats.impostors;
+        }
+        else if(d.path==PATH_PROCEDURAL_SPHERE){
+            glState.uniform2i(u.sphereTess, d.sphereTess[0], d.sphereTess[1]);
+            glState.bindVertexArray(emptyVAO); glDrawArrays(GL_TRIANGLES,0,d.sphereTess[0]*d.sphereTess[1]*6);
+            frameStats.triangles += d.sphereTess[0]*d.sphereTess[1]*2;
+        }
+        else if(d.mesh) d.mesh->drawElements(d.meshLod);
+        else{
+            glState.bindVertexArray(d.vao); glDrawArrays(d.mode,0,d.count);
+            if(d.mode==GL_TRIANGLES) frameStats.triangles += d.count/3;
+        }
+    }
+}
+
+// Read-only view of a whole file, memory-mapped so parsers can walk it without copying
+struct MappedFile {
+    const char* data=nullptr; size_t size=0;
+#ifdef _WIN32
+    HANDLE file=INVALID_HANDLE_VALUE, mapping=nullptr;
+#endif
+    MappedFile() = default;
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    ~MappedFile(){ close(); }
+    bool open(const string& path){
+        close();
+#ifdef _WIN32
+        file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if(file==INVALID_HANDLE_VALUE) return false;
+        LARGE_INTEGER sz; GetFileSizeEx(file,&sz); size = (size_t)sz.QuadPart;
+        if(size==0) return true;
+        mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if(mapping) data = (const char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+        if(!data){ close(); return false; }
+#else
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if(fd<0) return false;
+        struct stat st;
+        if(fstat(fd,&st)!=0){ ::close(fd); return false; }
+        size = (size_t)st.st_size;
+        if(size>0){
+            void* p = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if(p!=MAP_FAILED){ data = (const char*)p; madvise(p, size, MADV_SEQUENTIAL); }
+        }
+        ::close(fd);
+        if(size>0 && !data){ size=0; return false; }
+#endif
+        return true;
+    }
+    void close(){
+#ifdef _WIN32
+        if(data) UnmapViewOfFile(data);
+        if(mapping) CloseHandle(mapping);
+        if(file!=INVALID_HANDLE_VALUE) CloseHandle(file);
+        mapping=nullptr; file=INVALID_HANDLE_VALUE;
+#else
+        if(data) munmap((void*)data, size);
+#endif
+        data=nullptr; size=0;
+    }
+};
+
+// Runs fn(0..n-1) on n threads, fn(0) on the caller's
+template<class F> void parallelFor(int n, F fn){
+    vector<thread> workers;
+    for(int i=1;i<n;++i) workers.emplace_back(fn,i);
+    fn(0);
+    for(auto& w: workers) w.join();
+}
+
+// Number parsers for OBJ text: skip leading blanks, stop at the first character that cannot continue the number.
+// Floats go through a 64-bit mantissa and a power of ten, not correctly rounded in the last bit of a double,
+// which a float mesh never sees.
+inline bool isObjBlank(char c){ return c==' ' || c=='\t' || c=='\r'; }
+const char* parseObjFloat(const char* p, const char* end, float& out){
+    static const double POW10[] = { 1e0,1e1,1e2,1e3,1e4,1e5,1e6,1e7,1e8,1e9,1e10,1e11,
+                                    1e12,1e13,1e14,1e15,1e16,1e17,1e18,1e19,1e20,1e21,1e22 };
+    while(p<end && isObjBlank(*p)) ++p;
+    bool neg = false;
+    if(p<end && (*p=='-' || *p=='+')) neg = *p++=='-';
+    uint64_t m=0; int e=0;
+    for(; p<end && unsigned(*p-'0')<10; ++p){ if(m<100000000000000000ull) m = m*10 + (*p-'0'); else ++e; }
+    if(p<end && *p=='.'){
+        for(++p; p<end && unsigned(*p-'0')<10; ++p) if(m<100000000000000000ull){ m = m*10 + (*p-'0'); --e; }
+    }
+    if(p<end && (*p=='e' || *p=='E')){
+        ++p; bool eneg = false; int x=0;
+        if(p<end && (*p=='-' || *p=='+')) eneg = *p++=='-';
+        for(; p<end && unsigned(*p-'0')<10; ++p) if(x<10000) x = x*10 + (*p-'0');
+        e += eneg ? -x : x;
+    }
+    double v = (double)m;
+    if(e<0) v = e>=-22 ? v/POW10[-e] : v*pow(10.0,(double)e);
+    else if(e>0) v = e<=22 ? v*POW10[e] : v*pow(10.0,(double)e);
+    out = (float)(neg ? -v : v);
+    return p;
+}
+// Returns nullptr when there is no digit
+const char* parseObjInt(const char* p, const char* end, int& out){
+    bool neg = false;
+    if(p<end && (*p=='-' || *p=='+')) neg = *p++=='-';
+    if(p>=end || unsigned(*p-'0')>=10) return nullptr;
+    int v=0;
+    for(; p<end && unsigned(*p-'0')<10; ++p) v = v*10 + (*p-'0');
+    out = neg ? -v : v;
+    return p;
+}
+
+// One face corner as written in the file, 1-based with 0 for a missing uv or normal
+struct ObjCorner {
+    int v, t, n;
+    bool operator==(const ObjCorner& o) const { return v==o.v && t==o.t && n==o.n; }
+};
+struct ObjCornerHash {
+    size_t operator()(const ObjCorner& k) const { return (size_t)k.v*73856093u ^ (size_t)k.t*19349663u ^ (size_t)k.n*83492791u; }
+};
+// Parsed OBJ before it becomes mesh vertices; corners come three per triangle
+struct ObjData {
+    vector<vec3> P, N; vector<vec2> T;
+    vector<ObjCorner> corners;
+};
+// A byte range of the file parsed on its own. Negative (relative) indices refer to elements that may sit in
+// an earlier chunk, so they are stored counted from this chunk's start and flagged in rel (bit 0 v, 1 t, 2 n).
+struct ObjChunk : ObjData { vector<uint8_t> rel; };
+
+void parseObjChunk(const char* p, const char* end, ObjChunk& c){
+    vector<ObjCorner> poly;     // corners of the current face, reused so faces of any size parse without allocating
+    vector<uint8_t> polyRel;
+    while(p<end){
+        const char* eol = (const char*)memchr(p,'\n',end-p);
+        if(!eol) eol = end;
+        while(p<eol && isObjBlank(*p)) ++p;
+        if(eol-p>=2 && p[0]=='v'){
+            if(isObjBlank(p[1])){ vec3 v; p=parseObjFloat(p+1,eol,v.x); p=parseObjFloat(p,eol,v.y); parseObjFloat(p,eol,v.z); c.P.push_back(v); }
+            else if(p[1]=='t'){ vec2 v; p=parseObjFloat(p+2,eol,v.x); parseObjFloat(p,eol,v.y); c.T.push_back(v); }
+            else if(p[1]=='n'){ vec3 v; p=parseObjFloat(p+2,eol,v.x); p=parseObjFloat(p,eol,v.y); parseObjFloat(p,eol,v.z); c.N.push_back(v); }
+        }
+        else if(eol-p>=2 && p[0]=='f' && isObjBlank(p[1])){
+            poly.clear(); polyRel.clear();
+            for(p+=1; p<eol; ){
+                while(p<eol && isObjBlank(*p)) ++p;
+                ObjCorner k{0,0,0}; uint8_t rel = 0;
+                const char* q = parseObjInt(p,eol,k.v);
+                if(!q) break;
+                p = q;
+                if(p<eol && *p=='/'){
+                    ++p;
+                    if(p<eol && *p!='/'){ q = parseObjInt(p,eol,k.t); if(q) p = q; }
+                    if(p<eol && *p=='/'){ ++p; q = parseObjInt(p,eol,k.n); if(q) p = q; }
+                }
+                while(p<eol && !isObjBlank(*p)) ++p; // anything we could not read in this token
+                if(k.v<0){ k.v += (int)c.P.size()+1; rel |= 1; }
+                if(k.t<0){ k.t += (int)c.T.size()+1; rel |= 2; }
+                if(k.n<0){ k.n += (int)c.N.size()+1; rel |= 4; }
+                poly.push_back(k); polyRel.push_back(rel);
+            }
+            for(size_t k=1;k+1<poly.size();++k){
+                c.corners.insert(c.corners.end(), {poly[0], poly[k], poly[k+1]});
+                c.rel.insert(c.rel.end(), {polyRel[0], polyRel[k], polyRel[k+1]});
+            }
+        }
+        p = eol+1;
+    }
+}
+
+// Files below this size are parsed on one thread; thread start-up would cost more than it saves
+const size_t OBJ_BYTES_PER_THREAD = 4u<<20;
+
+// Parses an OBJ file in parallel chunks split at line boundaries. threads<=0 picks one per core.
+bool parseOBJ(const string& path, ObjData& out, int threads=0){
+    MappedFile file;
+    if(!file.open(path)) return false;
+    const char* begin = file.data; const char* end = file.data+file.size;
+    if(threads<=0) threads = (int)std::max(1u, thread::hardware_concurrency());
+    threads = (int)std::max<size_t>(1, std::min<size_t>(threads, file.size/OBJ_BYTES_PER_THREAD));
+
+    vector<const char*> cuts(threads+1, end);
+    cuts[0] = begin;
+    for(int i=1;i<threads;++i){
+        const char* c = std::max(cuts[i-1], begin + file.size*i/threads);
+        const char* nl = c<end ? (const char*)memchr(c,'\n',end-c) : nullptr;
+        cuts[i] = nl ? nl+1 : end;
+    }
+    vector<ObjChunk> chunks(threads);
+    parallelFor(threads, [&](int i){ parseObjChunk(cuts[i], cuts[i+1], chunks[i]); });
+
+    // Each chunk's elements land after all earlier chunks'; relative indices are rebased onto those offsets
+    vector<size_t> baseP(threads+1,0), baseT(threads+1,0), baseN(threads+1,0), baseC(threads+1,0);
+    for(int i=0;i<threads;++i){
+        baseP[i+1] = baseP[i]+chunks[i].P.size(); baseT[i+1] = baseT[i]+chunks[i].T.size();
+        baseN[i+1] = baseN[i]+chunks[i].N.size(); baseC[i+1] = baseC[i]+chunks[i].corners.size();
+    }
+    out.P.resize(baseP[threads]); out.T.resize(baseT[threads]); out.N.resize(baseN[threads]);
+    out.corners.resize(baseC[threads]);
+    parallelFor(threads, [&](int i){
+        const ObjChunk& c = chunks[i];
+        std::copy(c.P.begin(), c.P.end(), out.P.begin()+baseP[i]);
+        std::copy(c.T.begin(), c.T.end(), out.T.begin()+baseT[i]);
+        std::copy(c.N.begin(), c.N.end(), out.N.begin()+baseN[i]);
+        for(size_t k=0;k<c.corners.size();++k){
+            ObjCorner o = c.corners[k]; uint8_t rel = c.rel[k];
+            if(rel&1) o.v += (int)baseP[i];
+            if(rel&2) o.t += (int)baseT[i];
+            if(rel&4) o.n += (int)baseN[i];
+            out.corners[baseC[i]+k] = o;
+        }
+    });
+    return true;
+}
+
+// --bench-obj [file]: parse throughput single-threaded and on every core, best of several runs, no GL needed
+void benchOBJ(const string& path){
+    MappedFile file;
+    if(!file.open(path)){ cerr<<"Cannot open "<<path<<"\n"; return; }
+    double mb = file.size/1048576.0;
+    cout<<"OBJ parse: "<<path<<" ("<<mb<<" MB)\n";
+    int cores = (int)std::max(1u, thread::hardware_concurrency());
+    for(int threads: {1, cores}){
+        double best = 1e30; ObjData d;
+        for(int run=0;run<5;++run){
+            d = ObjData();
+            auto start = chrono::steady_clock::now();
+            parseOBJ(path, d, threads);
+            best = std::min(best, chrono::duration<double,milli>(chrono::steady_clock::now()-start).count());
+        }
+        int used = (int)std::max<size_t>(1, std::min<size_t>(threads, file.size/OBJ_BYTES_PER_THREAD));
+        printf("  %2d thread(s): %8.2f ms  %8.1f MB/s  (%zu positions, %zu triangles)\n",
+               used, best, mb/(best/1000.0), d.P.size(), d.corners.size()/3);
+        if(cores==1) break;
+    }
+}
+
+// Processed meshes are kept in a sidecar next to the source (models/x.obj -> models/x.obj.meshcache) holding
+// the vertex and index buffers in their GPU layout, so a warm start maps the file and uploads it unparsed.
+// The cache is rebuilt when the header does not match this build's vertex format, the source's size or
+// mtime changed, or the payload checksum fails.
+const char MESH_CACHE_MAGIC[4] = {'S','S','M','C'};
+const uint32_t MESH_CACHE_VERSION = 3;
+bool meshCacheEnabled = true;
+struct MeshCacheHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t packedVertices;            // 1 = VertexPacked, 0 = VertexPTN
+    uint32_t indexType;
+    uint32_t optimized;                 // 1 = reordered by optimizeMesh
+    uint32_t lodCount;                  // MeshLod records between the header and the buffers
+    uint64_t vertexBytes, indexBytes;   // payload: LOD table, vertices, then indices
+    uint64_t sourceSize;
+    int64_t  sourceMtime;
+    uint64_t checksum;                  // fnv1a of the payload
+    float    boundRadius;
+    uint32_t reserved;
+};
+
+string meshCachePath(const string& source){ return source+".meshcache"; }
+bool meshSourceStamp(const string& source, uint64_t& size, int64_t& mtime){
+    error_code ec;
+    size = filesystem::file_size(source,ec);
+    if(ec) return false;
+    mtime = (int64_t)filesystem::last_write_time(source,ec).time_since_epoch().count();
+    return !ec;
+}
+
+// A mesh made ready off the GL thread: CPU arrays in mesh, or buffers still sitting in the mapped cache file
+struct PreparedMesh {
+    Mesh mesh;
+    MappedFile cache;
+    const char* vertexBytes=nullptr; const char* indexBytes=nullptr;
+    size_t vertexSize=0, indexSize=0;
+    // GL thread
+    void upload(){
+        if(vertexBytes) mesh.uploadBytes(vertexBytes,vertexSize,indexBytes,indexSize);
+        else mesh.upload();
+        cache.close(); vertexBytes = indexBytes = nullptr;
+    }
+};
+
+bool loadMeshCache(const string& source, PreparedMesh& out){
+    string path = meshCachePath(source);
+    uint64_t srcSize; int64_t srcMtime;
+    if(!meshSourceStamp(source,srcSize,srcMtime)) return false;
+    MappedFile& file = out.cache;
+    if(!file.open(path)) return false;
+    auto reject = [&](const char* why){ cout<<"Mesh cache "<<path<<" "<<why<<", rebuilding\n"; file.close(); return false; };
+    if(file.size<sizeof(MeshCacheHeader)) return reject("is truncated");
+    MeshCacheHeader h; memcpy(&h,file.data,sizeof(h));
+    if(memcmp(h.magic,MESH_CACHE_MAGIC,4)!=0 || h.version!=MESH_CACHE_VERSION) return reject("has an old format");
+    if(h.packedVertices!=(usePackedVertices ? 1u : 0u)) return reject("has a different vertex format");
+    if(h.optimized!=(meshOptimizeEnabled ? 1u : 0u)) return reject("has a different vertex order");
+    if(h.sourceSize!=srcSize || h.sourceMtime!=srcMtime) return reject("is stale");
+    if(h.indexType!=GL_UNSIGNED_SHORT && h.indexType!=GL_UNSIGNED_INT) return reject("is corrupt");
+    size_t lodBytes = (size_t)h.lodCount*sizeof(MeshLod);
+    if(h.lodCount==0 || h.lodCount>16) return reject("is corrupt");
+    if(file.size!=sizeof(h)+lodBytes+h.vertexBytes+h.indexBytes || h.vertexBytes%vertexStride()!=0) return reject("is truncated");
+    const char* payload = file.data+sizeof(h);
+    if(fnv1a((const void*)payload,lodBytes+h.vertexBytes+h.indexBytes)!=h.checksum) return reject("fails its checksum");
+    Mesh& m = out.mesh;
+    m.vertices.clear(); m.indices.clear();
+    m.indexType = h.indexType;
+    m.lods.resize(h.lodCount); memcpy(m.lods.data(),payload,lodBytes);
+    m.boundRadius = h.boundRadius;
+    out.vertexBytes = payload+lodBytes;                 out.vertexSize = h.vertexBytes;
+    out.indexBytes = payload+lodBytes+h.vertexBytes;    out.indexSize = h.indexBytes;
+    return true;
+}
+
+void saveMeshCache(const string& source, const Mesh& m){
+    MeshCacheHeader h{};
+    memcpy(h.magic,MESH_CACHE_MAGIC,4);
+    h.version = MESH_CACHE_VERSION;
+    h.packedVertices = usePackedVertices ? 1 : 0;
+    h.indexType = m.indexType;
+    h.optimized = meshOptimizeEnabled ? 1 : 0;
+    h.lodCount = (uint32_t)m.lods.size();
+    h.boundRadius = m.boundRadius;
+    if(!meshSourceStamp(source,h.sourceSize,h.sourceMtime)) return;
+    vector<uint8_t> v = m.vertexData(), i = m.indexData();
+    h.vertexBytes = v.size(); h.indexBytes = i.size();
+    size_t lodBytes = m.lods.size()*sizeof(MeshLod);
+    h.checksum = fnv1a(i.data(),i.size(),fnv1a(v.data(),v.size(),fnv1a(m.lods.data(),lodBytes)));
+    // Written under a temporary name and renamed, so a crash never leaves a half-written cache behind
+    string path = meshCachePath(source), tmp = path+".tmp";
+    {
+        ofstream f(tmp, ios::binary);
+        f.write((const char*)&h,sizeof(h));
+        f.write((const char*)m.lods.data(),lodBytes);
+        f.write((const char*)v.data(),v.size());
+        f.write((const char*)i.data(),i.size());
+        if(!f.good()) return;
+    }
+    error_code ec; filesystem::rename(tmp,path,ec);
+}
+
+// Everything but the GL upload, so it can run on a worker thread
+bool loadOBJ(const string& path, PreparedMesh& prepared){
+    auto start = chrono::steady_clock::now();
+    Mesh& out = prepared.mesh;
+    if(meshCacheEnabled && loadMeshCache(path,prepared)){
+        cout<<"Loaded OBJ: "<<path<<" from mesh cache, tris="<<out.lods[0].indexCount/3<<", "<<out.lodCount()<<" LODs ("
+            <<chrono::duration<double,milli>(chrono::steady_clock::now()-start).count()<<" ms)\n";
+        return true;
+    }
+    ObjData d;
+    if(!parseOBJ(path, d)){ cout<<"OBJ not found: "<<path<<" (will use fallback)\n"; return false; }
+    double parseMs = chrono::duration<double,milli>(chrono::steady_clock::now()-start).count();
+    // Corners that name the same position/uv/normal triple share one vertex
     out.vertices.clear(); out.indices.clear();
-    out.vertices.reserve(ip.size());
-    for(size_t i=0;i<ip.size();++i){
-        VertexPTN v{};
-        v.p = P[ip[i]-1];
-        v.c = defaultColor;
-        v.uv = (it[i]>0 && it[i]<=T.size()) ? T[it[i]-1] : vec2(0.0f);
-        v.n  = (in[i]>0 && in[i]<=N.size()) ? N[in[i]-1] : vec3(0,1,0);
-        out.vertices.push_back(v);
-        out.indices.push_back((unsigned)i);
-    }
-    out.upload();
-    cout<<"Loaded OBJ: "<<path<<" verts="<<out.vertices.size()<<" tris="<<out.indices.size()/3<<"\n";
+    out.indices.reserve(d.corners.size());
+    unordered_map<ObjCorner,unsigned,ObjCornerHash> unique;
+    unique.reserve(d.corners.size()/2);
+    for(ObjCorner k: d.corners){
+        if(k.v<=0 || k.v>(int)d.P.size()) k.v = 0;
+        if(k.t<=0 || k.t>(int)d.T.size()) k.t = 0;
+        if(k.n<=0 || k.n>(int)d.N.size()) k.n = 0;
+        auto ins = unique.emplace(k,(unsigned)out.vertices.size());
+        if(ins.second){
+            VertexPTN v{};
+            v.p  = k.v ? d.P[k.v-1] : vec3(0.0f);
+            v.uv = k.t ? d.T[k.t-1] : vec2(0.0f);
+            v.n  = k.n ? d.N[k.n-1] : vec3(0,1,0);
+            out.vertices.push_back(v);
+        }
+        out.indices.push_back(ins.first->second);
+    }
+    out.indexType = out.vertices.size()<=65536 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+    optimizeMesh(out, "Ship mesh");
+    reportVertexFormat("Ship mesh", out, simulateVertexCache(out.indices));
+    buildMeshLods(out, "Ship mesh");
+    if(meshCacheEnabled) saveMeshCache(path,out);
+    cout<<"Loaded OBJ: "<<path<<" verts="<<out.vertices.size()<<" tris="<<out.lods[0].indexCount/3<<" (parsed in "<<parseMs<<" ms)\n";
+    printf("  dedup: %zu corners -> %zu vertices (%.2fx), %s indices\n", d.corners.size(), out.vertices.size(),
+           out.vertices.empty() ? 0.0 : (double)d.corners.size()/out.vertices.size(),
+           out.indexType==GL_UNSIGNED_SHORT ? "16-bit" : "32-bit");
     return true;
 }
 
 Mesh makeFallbackShip(){
     Mesh m;
     vector<VertexPTN> V = {
-        {{ 0, 0.3f,  1.2f},{0.9,0.9,1.0},{0,0},{0,1,0}},
-        {{-0.6f,0, -1.0f},{0.7,0.7,0.9},{0,0},{-0.2,0.8,-0.5}},
-        {{ 0.6f,0, -1.0f},{0.7,0.7,0.9},{0,0},{ 0.2,0.8,-0.5}},
-        {{ 0, 0.7f,-0.4f},{0.8,0.8,1.0},{0,0},{0,1,0}}, 
-        {{ 0, -0.2f,-0.4f},{0.6,0.6,0.9},{0,0},{0,-1,0}}, 
-        {{-1.0f,0,-0.2f},{0.6,0.6,1.0},{0,0},{-1,0,0}}, 
-        {{ 1.0f,0,-0.2f},{0.6,0.6,1.0},{0,0},{ 1,0,0}}, 
+        {{ 0, 0.3f,  1.2f},{0,0},{0,1,0}},
+        {{-0.6f,0, -1.0f},{0,0},{-0.2,0.8,-0.5}},
+        {{ 0.6f,0, -1.0f},{0,0},{ 0.2,0.8,-0.5}},
+        {{ 0, 0.7f,-0.4f},{0,0},{0,1,0}}, 
+        {{ 0, -0.2f,-0.4f},{0,0},{0,-1,0}}, 
+        {{-1.0f,0,-0.2f},{0,0},{-1,0,0}}, 
+        {{ 1.0f,0,-0.2f},{0,0},{ 1,0,0}}, 
     };
     vector<unsigned> I = {
         0,1,3, 0,3,2, 
@@ -370,36 +1412,512 @@ Mesh makeFallbackShip(){
         1,5,3, 3,5,2,  
         1,4,5, 2,6,4,  
     };
-    m.vertices = V; m.indices = I; m.upload();
-    cout<<"Using fallback ship mesh.\n";
+    m.vertices = V; m.indices = I; optimizeMesh(m); m.upload();
     return m;
 }
 
-GLuint loadTexture(const char* filename) {
+// Decoded pixels waiting for upload, with the mip chain built on the CPU. Safe on any thread.
+struct DecodedImage {
+    struct Level { int w, h; vector<unsigned char> pixels; };
+    int w=0, h=0, channels=0;
+    unique_ptr<unsigned char, void(*)(void*)> data{nullptr, stbi_image_free}; // level 0, tightly packed rows
+    vector<Level> mips;                                                       // levels 1..n
+    double decodeMs=0, mipMs=0;
+};
+
+// Adds two rows bytewise into 16-bit sums, sixteen bytes per step with SSE2
+void addRows(const unsigned char* a, const unsigned char* b, uint16_t* out, size_t n){
+    size_t i = 0;
+#ifdef HAVE_SSE2
+    const __m128i zero = _mm_setzero_si128();
+    for(; i+16<=n; i+=16){
+        __m128i va = _mm_loadu_si128((const __m128i*)(a+i)), vb = _mm_loadu_si128((const __m128i*)(b+i));
+        _mm_storeu_si128((__m128i*)(out+i),   _mm_add_epi16(_mm_unpacklo_epi8(va,zero), _mm_unpacklo_epi8(vb,zero)));
+        _mm_storeu_si128((__m128i*)(out+i+8), _mm_add_epi16(_mm_unpackhi_epi8(va,zero), _mm_unpackhi_epi8(vb,zero)));
+    }
+#endif
+    for(; i<n; ++i) out[i] = (uint16_t)(a[i]+b[i]);
+}
+// Horizontal half of the box filter over a row of vertical sums: out pixel x = (s[2x] + s[2x+1] + 2) >> 2 per
+// channel. With SSE2 the pair add, rounding, narrowing and store stay in registers for one to four channels;
+// the scalar loop finishes the last few pixels.
+void addPairs(const uint16_t* s, int w, int c, unsigned char* out){
+    int ow = std::max(1,w/2), x = 0;
+#ifdef HAVE_SSE2
+    const __m128i two = _mm_set1_epi16(2);
+    auto narrow = [&](__m128i lo, __m128i hi){ return _mm_packus_epi16(_mm_srli_epi16(_mm_add_epi16(lo,two),2), _mm_srli_epi16(_mm_add_epi16(hi,two),2)); };
+    if(c==4){
+        // one load holds a pixel pair; fold the high half onto the low
+        for(; x+4<=ow; x+=4){
+            __m128i p[4];
+            for(int k=0;k<4;++k){ __m128i v = _mm_loadu_si128((const __m128i*)(s+(size_t)(x+k)*8)); p[k] = _mm_add_epi16(v,_mm_srli_si128(v,8)); }
+            _mm_storeu_si128((__m128i*)(out+(size_t)x*4), narrow(_mm_unpacklo_epi64(p[0],p[1]),_mm_unpacklo_epi64(p[2],p[3])));
+        }
+    }
+    else if(c==3){
+        // two loads of 4 pixels overlap by one pair; fold each onto lanes 0-2 and join them into lanes 0-5.
+        // The 8-byte store runs 2 bytes into the next pixel, which the next step overwrites.
+        const __m128i low3 = _mm_setr_epi16(-1,-1,-1,0,0,0,0,0);
+        for(; x+3<=ow; x+=2){
+            __m128i a = _mm_loadu_si128((const __m128i*)(s+(size_t)x*6)), b = _mm_loadu_si128((const __m128i*)(s+(size_t)x*6+6));
+            a = _mm_and_si128(_mm_add_epi16(a,_mm_srli_si128(a,6)),low3);
+            b = _mm_add_epi16(b,_mm_srli_si128(b,6));
+            __m128i r = _mm_or_si128(a,_mm_slli_si128(b,6));
+            _mm_storel_epi64((__m128i*)(out+(size_t)x*3), narrow(r,r));
+        }
+    }
+    else if(c==2){
+        // pairs land in 32-bit lanes 0 and 2; gather them into the low half
+        for(; x+4<=ow; x+=4){
+            __m128i a = _mm_loadu_si128((const __m128i*)(s+(size_t)x*4)), b = _mm_loadu_si128((const __m128i*)(s+(size_t)x*4+8));
+            a = _mm_shuffle_epi32(_mm_add_epi16(a,_mm_srli_si128(a,4)),_MM_SHUFFLE(3,1,2,0));
+            b = _mm_shuffle_epi32(_mm_add_epi16(b,_mm_srli_si128(b,4)),_MM_SHUFFLE(3,1,2,0));
+            __m128i r = _mm_unpacklo_epi64(a,b);
+            _mm_storel_epi64((__m128i*)(out+(size_t)x*2), narrow(r,r));
+        }
+    }
+    else if(c==1){
+        const __m128i ones = _mm_set1_epi16(1);
+        for(; x+8<=ow; x+=8){
+            __m128i a = _mm_madd_epi16(_mm_loadu_si128((const __m128i*)(s+(size_t)x*2)),ones);
+            __m128i b = _mm_madd_epi16(_mm_loadu_si128((const __m128i*)(s+(size_t)x*2+8)),ones);
+            __m128i r = _mm_packs_epi32(a,b);
+            _mm_storel_epi64((__m128i*)(out+x), narrow(r,r));
+        }
+    }
+#endif
+    for(; x<ow; ++x){
+        const uint16_t* s0 = &s[(size_t)2*x*c];
+        const uint16_t* s1 = &s[(size_t)std::min(2*x+1,w-1)*c];
+        for(int k=0;k<c;++k) out[x*c+k] = (unsigned char)((s0[k]+s1[k]+2)>>2);
+    }
+}
+// 2x2 box filter to the next level, rounding to nearest: addRows sums row pairs, addPairs column pairs.
+// Odd edges drop their last row/column like GL does.
+void downsampleLevel(const unsigned char* src, int w, int h, int c, DecodedImage::Level& dst){
+    dst.w = std::max(1,w/2); dst.h = std::max(1,h/2);
+    dst.pixels.resize((size_t)dst.w*dst.h*c);
+    vector<uint16_t> sum((size_t)w*c);
+    for(int y=0;y<dst.h;++y){
+        addRows(src+(size_t)std::min(2*y,h-1)*w*c, src+(size_t)std::min(2*y+1,h-1)*w*c, sum.data(), sum.size());
+        addPairs(sum.data(), w, c, &dst.pixels[(size_t)y*dst.w*c]);
+    }
+}
+DecodedImage decodeImage(const char* filename){
+    DecodedImage img;
+    auto start = chrono::steady_clock::now();
+    img.data.reset(stbi_load(filename,&img.w,&img.h,&img.channels,0));
+    auto decoded = chrono::steady_clock::now();
+    img.decodeMs = chrono::duration<double,milli>(decoded-start).count();
+    if(!img.data) return img;
+    const unsigned char* src = img.data.get(); int w = img.w, h = img.h;
+    while(w>1 || h>1){
+        img.mips.emplace_back();
+        downsampleLevel(src, w, h, img.channels, img.mips.back());
+        src = img.mips.back().pixels.data(); w = img.mips.back().w; h = img.mips.back().h;
+    }
+    img.mipMs = chrono::duration<double,milli>(chrono::steady_clock::now()-decoded).count();
+    return img;
+}
+// A texture object holding a 4x4 checkerboard until the real image is uploaded into it
+GLuint createTexture(){
     GLuint tex; glGenTextures(1,&tex); glBindTexture(GL_TEXTURE_2D,tex);
     glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_WRAP_S,GL_REPEAT);
     glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_WRAP_T,GL_REPEAT);
     glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MIN_FILTER,GL_LINEAR_MIPMAP_LINEAR);
     glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MAG_FILTER,GL_LINEAR);
-    int w,h,n; unsigned char* data = stbi_load(filename,&w,&h,&n,0);
-    if(data){
-        GLenum fmt = (n==4)?GL_RGBA:GL_RGB;
-        glTexImage2D(GL_TEXTURE_2D,0,fmt,w,h,0,fmt,GL_UNSIGNED_BYTE,data);
-        glGenerateMipmap(GL_TEXTURE_2D);
-        stbi_image_free(data);
-        cout<<"Loaded texture: "<<filename<<" ("<<w<<"x"<<h<<")\n";
-    }else{
-        cout<<"Using fallback texture for: "<<filename<<"\n";
-        unsigned char checker[] = {
-            255,255,255,  80,80,80,  255,255,255,  80,80,80,
-            80,80,80,    255,255,255,80,80,80,    255,255,255,
-            255,255,255,  80,80,80,  255,255,255,  80,80,80,
-            80,80,80,    255,255,255,80,80,80,    255,255,255
-        };
-        glTexImage2D(GL_TEXTURE_2D,0,GL_RGB,4,4,0,GL_RGB,GL_UNSIGNED_BYTE,checker);
-    }
+    unsigned char checker[] = {
+        255,255,255,  80,80,80,  255,255,255,  80,80,80,
+        80,80,80,    255,255,255,80,80,80,    255,255,255,
+        255,255,255,  80,80,80,  255,255,255,  80,80,80,
+        80,80,80,    255,255,255,80,80,80,    255,255,255
+    };
+    glTexImage2D(GL_TEXTURE_2D,0,GL_RGB,4,4,0,GL_RGB,GL_UNSIGNED_BYTE,checker);
+    glGenerateMipmap(GL_TEXTURE_2D);
     return tex;
 }
+// Uploads every level explicitly; the driver does no mip generation
+void uploadTexture(GLuint tex, const DecodedImage& img, const char* filename){
+    if(!img.data){ cout<<"Using fallback texture for: "<<filename<<"\n"; return; }
+    auto start = chrono::steady_clock::now();
+    glBindTexture(GL_TEXTURE_2D,tex);
+    glPixelStorei(GL_UNPACK_ALIGNMENT,1); // stb rows are tightly packed, and RGB widths are rarely a multiple of 4
+    GLenum fmt = img.channels==4 ? GL_RGBA : img.channels==3 ? GL_RGB : img.channels==2 ? GL_RG : GL_RED;
+    glTexImage2D(GL_TEXTURE_2D,0,fmt,img.w,img.h,0,fmt,GL_UNSIGNED_BYTE,img.data.get());
+    for(size_t l=0;l<img.mips.size();++l)
+        glTexImage2D(GL_TEXTURE_2D,(GLint)l+1,fmt,img.mips[l].w,img.mips[l].h,0,fmt,GL_UNSIGNED_BYTE,img.mips[l].pixels.data());
+    glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MAX_LEVEL,(GLint)img.mips.size());
+    glPixelStorei(GL_UNPACK_ALIGNMENT,4);
+    printf("Loaded texture: %s (%dx%d, %zu levels) decode %.1f ms, mips %.1f ms, upload %.1f ms\n", filename, img.w, img.h,
+           img.mips.size()+1, img.decodeMs, img.mipMs, chrono::duration<double,milli>(chrono::steady_clock::now()-start).count());
+}
+
+// --compressed-textures: each texture is transcoded once to BC1 (BC3 when it has alpha) with its whole mip
+// chain and kept next to the source as <file>.texcache; later runs map it and upload the blocks with
+// glCompressedTexImage2D, skipping the JPEG decode. Without S3TC support, or while the cache is missing or
+// stale, textures take the stbi path and the worker writes the cache for next time.
+bool compressedTextures = false;
+const char TEXTURE_CACHE_MAGIC[4] = {'S','S','T','C'};
+const uint32_t TEXTURE_CACHE_VERSION = 1;
+struct TextureCacheHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t format;                    // GL_COMPRESSED_RGB_S3TC_DXT1_EXT or GL_COMPRESSED_RGBA_S3TC_DXT5_EXT
+    uint32_t levels;                    // TextureCacheLevel records follow the header, then the blocks
+    uint64_t sourceSize;
+    int64_t  sourceMtime;
+    uint64_t checksum;                  // fnv1a of everything after the header
+};
+struct TextureCacheLevel { uint32_t w, h; uint64_t offset, size; }; // offset from the start of the blocks
+
+int rgb565(const unsigned char* c){ return ((c[0]>>3)<<11) | ((c[1]>>2)<<5) | (c[2]>>3); }
+void expand565(int v, int out[3]){
+    int r = (v>>11)&31, g = (v>>5)&63, b = v&31;
+    out[0] = (r<<3)|(r>>2); out[1] = (g<<2)|(g>>4); out[2] = (b<<3)|(b>>2);
+}
+// BC1 colour block from 16 RGBA texels: endpoints from the inset bounding box of the block's colours,
+// four-colour mode, each texel to the nearest of the four palette entries
+void encodeBC1Block(const unsigned char px[16][4], unsigned char out[8]){
+    int lo[3] = {255,255,255}, hi[3] = {0,0,0};
+    for(int i=0;i<16;++i) for(int k=0;k<3;++k){ lo[k] = std::min(lo[k],(int)px[i][k]); hi[k] = std::max(hi[k],(int)px[i][k]); }
+    unsigned char c0[3], c1[3];
+    for(int k=0;k<3;++k){ int inset = (hi[k]-lo[k])>>4; c0[k] = (unsigned char)(hi[k]-inset); c1[k] = (unsigned char)(lo[k]+inset); }
+    int e0 = rgb565(c0), e1 = rgb565(c1);
+    uint32_t bits = 0;
+    if(e0<e1) std::swap(e0,e1);
+    if(e0!=e1){
+        int pal[4][3]; expand565(e0,pal[0]); expand565(e1,pal[1]);
+        for(int k=0;k<3;++k){ pal[2][k] = (2*pal[0][k]+pal[1][k])/3; pal[3][k] = (pal[0][k]+2*pal[1][k])/3; }
+        for(int i=0;i<16;++i){
+            int best = 0, bestD = INT32_MAX;
+            for(int p=0;p<4;++p){
+                int dr = px[i][0]-pal[p][0], dg = px[i][1]-pal[p][1], db = px[i][2]-pal[p][2];
+                int d = dr*dr + dg*dg + db*db;
+                if(d<bestD){ bestD = d; best = p; }
+            }
+            bits |= (uint32_t)best << (2*i);
+        }
+    }
+    out[0] = (unsigned char)e0; out[1] = (unsigned char)(e0>>8); out[2] = (unsigned char)e1; out[3] = (unsigned char)(e1>>8);
+    for(int k=0;k<4;++k) out[4+k] = (unsigned char)(bits>>(8*k));
+}
+// BC3 alpha block: eight-value ramp between the block's min and max alpha
+void encodeBC3AlphaBlock(const unsigned char px[16][4], unsigned char out[8]){
+    int a0 = 0, a1 = 255;
+    for(int i=0;i<16;++i){ a0 = std::max(a0,(int)px[i][3]); a1 = std::min(a1,(int)px[i][3]); }
+    uint64_t bits = 0;
+    if(a0>a1){
+        for(int i=0;i<16;++i){
+            int t = ((px[i][3]-a1)*7 + (a0-a1)/2) / (a0-a1); // 0 at a1 .. 7 at a0
+            int code = t==7 ? 0 : t==0 ? 1 : 8-t;             // codes 2..7 run from a0 towards a1
+            bits |= (uint64_t)code << (3*i);
+        }
+    }
+    out[0] = (unsigned char)a0; out[1] = (unsigned char)a1;
+    for(int k=0;k<6;++k) out[2+k] = (unsigned char)(bits>>(8*k));
+}
+// Block-compresses one level of tightly packed 1-4 channel pixels
+vector<unsigned char> compressLevel(const unsigned char* src, int w, int h, int channels, bool alpha){
+    int bw = (w+3)/4, bh = (h+3)/4, blockBytes = alpha ? 16 : 8;
+    vector<unsigned char> out((size_t)bw*bh*blockBytes);
+    unsigned char px[16][4];
+    for(int by=0;by<bh;++by) for(int bx=0;bx<bw;++bx){
+        for(int i=0;i<16;++i){
+            int x = std::min(bx*4+(i&3), w-1), y = std::min(by*4+(i>>2), h-1);
+            const unsigned char* s = src + ((size_t)y*w+x)*channels;
+            px[i][0] = s[0]; px[i][1] = s[channels>=3 ? 1 : 0]; px[i][2] = s[channels>=3 ? 2 : 0];
+            px[i][3] = channels==4 ? s[3] : channels==2 ? s[1] : 255;
+        }
+        unsigned char* block = &out[((size_t)by*bw+bx)*blockBytes];
+        if(alpha){ encodeBC3AlphaBlock(px,block); block += 8; }
+        encodeBC1Block(px,block);
+    }
+    return out;
+}
+
+string textureCachePath(const char* source){ return string(source)+".texcache"; }
+
+// Worker side: the validated mapping of a texture cache
+struct CompressedImage {
+    MappedFile file;
+    TextureCacheHeader header;
+    const TextureCacheLevel* levels=nullptr;
+    const char* blocks=nullptr;
+};
+bool loadTextureCache(const char* source, CompressedImage& img){
+    string path = textureCachePath(source);
+    uint64_t srcSize; int64_t srcMtime;
+    if(!meshSourceStamp(source,srcSize,srcMtime) || !img.file.open(path)) return false;
+    auto reject = [&](const char* why){ cout<<"Texture cache "<<path<<" "<<why<<", rebuilding\n"; img.file.close(); return false; };
+    const MappedFile& f = img.file;
+    TextureCacheHeader& h = img.header;
+    if(f.size<sizeof(h)) return reject("is truncated");
+    memcpy(&h,f.data,sizeof(h));
+    if(memcmp(h.magic,TEXTURE_CACHE_MAGIC,4)!=0 || h.version!=TEXTURE_CACHE_VERSION) return reject("has an old format");
+    if(h.sourceSize!=srcSize || h.sourceMtime!=srcMtime) return reject("is stale");
+    if(h.levels==0 || h.levels>16 || f.size<sizeof(h)+h.levels*sizeof(TextureCacheLevel)) return reject("is corrupt");
+    if(fnv1a((const void*)(f.data+sizeof(h)),f.size-sizeof(h))!=h.checksum) return reject("fails its checksum");
+    img.levels = (const TextureCacheLevel*)(f.data+sizeof(h));
+    img.blocks = f.data+sizeof(h)+h.levels*sizeof(TextureCacheLevel);
+    size_t blockBytes = f.size-sizeof(h)-h.levels*sizeof(TextureCacheLevel);
+    for(uint32_t l=0;l<h.levels;++l)
+        if(img.levels[l].offset+img.levels[l].size>blockBytes) return reject("is corrupt");
+    return true;
+}
+void saveTextureCache(const char* source, const DecodedImage& img){
+    auto start = chrono::steady_clock::now();
+    TextureCacheHeader h{};
+    memcpy(h.magic,TEXTURE_CACHE_MAGIC,4);
+    h.version = TEXTURE_CACHE_VERSION;
+    bool alpha = img.channels==2 || img.channels==4;
+    h.format = alpha ? GL_COMPRESSED_RGBA_S3TC_DXT5_EXT : GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+    h.levels = (uint32_t)img.mips.size()+1;
+    if(!meshSourceStamp(source,h.sourceSize,h.sourceMtime)) return;
+    vector<TextureCacheLevel> levels;
+    vector<unsigned char> blocks;
+    for(uint32_t l=0;l<h.levels;++l){
+        int w = l ? img.mips[l-1].w : img.w, lh = l ? img.mips[l-1].h : img.h;
+        const unsigned char* src = l ? img.mips[l-1].pixels.data() : img.data.get();
+        vector<unsigned char> c = compressLevel(src, w, lh, img.channels, alpha);
+        levels.push_back({ (uint32_t)w, (uint32_t)lh, blocks.size(), c.size() });
+        blocks.insert(blocks.end(), c.begin(), c.end());
+    }
+    h.checksum = fnv1a(blocks.data(),blocks.size(),fnv1a(levels.data(),levels.size()*sizeof(TextureCacheLevel)));
+    string path = textureCachePath(source), tmp = path+".tmp";
+    {
+        ofstream f(tmp, ios::binary);
+        f.write((const char*)&h,sizeof(h));
+        f.write((const char*)levels.data(),levels.size()*sizeof(TextureCacheLevel));
+        f.write((const char*)blocks.data(),blocks.size());
+        if(!f.good()) return;
+    }
+    error_code ec; filesystem::rename(tmp,path,ec);
+    printf("Wrote texture cache %s (%s, %.0f KB) in %.1f ms\n", path.c_str(), alpha ? "BC3" : "BC1", blocks.size()/1024.0,
+           chrono::duration<double,milli>(chrono::steady_clock::now()-start).count());
+}
+void uploadCompressedTexture(GLuint tex, const CompressedImage& img, const char* filename){
+    auto start = chrono::steady_clock::now();
+    glBindTexture(GL_TEXTURE_2D,tex);
+    size_t bytes = 0;
+    for(uint32_t l=0;l<img.header.levels;++l){
+        const TextureCacheLevel& lv = img.levels[l];
+        glCompressedTexImage2D(GL_TEXTURE_2D,(GLint)l,img.header.format,lv.w,lv.h,0,(GLsizei)lv.size,img.blocks+lv.offset);
+        bytes += lv.size;
+    }
+    glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MAX_LEVEL,(GLint)img.header.levels-1);
+    printf("Loaded texture: %s (%ux%u, %s from cache, %.0f KB vs %.0f KB as RGBA8) upload %.1f ms\n", filename,
+           img.levels[0].w, img.levels[0].h, img.header.format==GL_COMPRESSED_RGB_S3TC_DXT1_EXT ? "BC1" : "BC3",
+           bytes/1024.0, bytes*(img.header.format==GL_COMPRESSED_RGB_S3TC_DXT1_EXT ? 8.0 : 4.0)/1024.0,
+           chrono::duration<double,milli>(chrono::steady_clock::now()-start).count());
+}
+
+// --texture-array: every body texture is resampled to one size and becomes a layer of a single
+// GL_TEXTURE_2D_ARRAY, so the body draws share one binding and select their image with textureLayer.
+bool textureArray = false;
+const int TEXTURE_ARRAY_WIDTH = 1024, TEXTURE_ARRAY_HEIGHT = 512; // equirectangular 2:1 like the source maps
+GLuint bodyTextureArray = 0;
+bool bodyLayerLoaded[BODY_TEXTURE_COUNT] = {};
+int textureArrayLevels(){ int l = 1; for(int s = std::max(TEXTURE_ARRAY_WIDTH,TEXTURE_ARRAY_HEIGHT); s>1; s>>=1) ++l; return l; }
+
+void createBodyTextureArray(){
+    glGenTextures(1,&bodyTextureArray); glBindTexture(GL_TEXTURE_2D_ARRAY,bodyTextureArray);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY,GL_TEXTURE_WRAP_S,GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY,GL_TEXTURE_WRAP_T,GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY,GL_TEXTURE_MIN_FILTER,GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY,GL_TEXTURE_MAG_FILTER,GL_LINEAR);
+    int levels = textureArrayLevels();
+    for(int l=0;l<levels;++l)
+        glTexImage3D(GL_TEXTURE_2D_ARRAY,l,GL_RGB8,std::max(1,TEXTURE_ARRAY_WIDTH>>l),std::max(1,TEXTURE_ARRAY_HEIGHT>>l),
+                     BODY_TEXTURE_COUNT,0,GL_RGB,GL_UNSIGNED_BYTE,nullptr);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY,GL_TEXTURE_MAX_LEVEL,levels-1);
+    printf("Body texture array: %dx%d, %d layers, %d levels, %.1f MB\n", TEXTURE_ARRAY_WIDTH, TEXTURE_ARRAY_HEIGHT,
+           BODY_TEXTURE_COUNT, levels, TEXTURE_ARRAY_WIDTH*TEXTURE_ARRAY_HEIGHT*4.0*BODY_TEXTURE_COUNT*4/3/(1024*1024));
+}
+// Bilinear resample to w x h RGB with a fresh mip chain. Sampling starts from the smallest source level
+// still at least the target size, so large downscales average instead of skipping texels.
+DecodedImage resampleImage(const DecodedImage& src, int w, int h){
+    DecodedImage out;
+    out.decodeMs = src.decodeMs;
+    if(!src.data) return out;
+    auto start = chrono::steady_clock::now();
+    const unsigned char* s = src.data.get(); int sw = src.w, sh = src.h, c = src.channels;
+    for(const DecodedImage::Level& l: src.mips){
+        if(l.w<w || l.h<h) break;
+        s = l.pixels.data(); sw = l.w; sh = l.h;
+    }
+    out.w = w; out.h = h; out.channels = 3;
+    out.data.reset((unsigned char*)malloc((size_t)w*h*3)); // released by stbi_image_free, which is free()
+    unsigned char* d = out.data.get();
+    for(int y=0;y<h;++y){
+        float fy = std::max(0.0f, (y+0.5f)*sh/h-0.5f);
+        int y0 = std::min((int)fy, sh-1), y1 = std::min(y0+1, sh-1); float ty = fy-y0;
+        for(int x=0;x<w;++x){
+            float fx = std::max(0.0f, (x+0.5f)*sw/w-0.5f);
+            int x0 = std::min((int)fx, sw-1), x1 = (x0+1)%sw; float tx = fx-x0; // longitude wraps
+            for(int k=0;k<3;++k){
+                int ch = c>=3 ? k : 0;
+                float a = s[((size_t)y0*sw+x0)*c+ch], b = s[((size_t)y0*sw+x1)*c+ch];
+                float e = s[((size_t)y1*sw+x0)*c+ch], f = s[((size_t)y1*sw+x1)*c+ch];
+                d[((size_t)y*w+x)*3+k] = (unsigned char)(a + (b-a)*tx + ((e + (f-e)*tx) - (a + (b-a)*tx))*ty + 0.5f);
+            }
+        }
+    }
+    const unsigned char* m = d; int mw = w, mh = h;
+    while(mw>1 || mh>1){
+        out.mips.emplace_back();
+        downsampleLevel(m, mw, mh, 3, out.mips.back());
+        m = out.mips.back().pixels.data(); mw = out.mips.back().w; mh = out.mips.back().h;
+    }
+    out.mipMs = src.mipMs + chrono::duration<double,milli>(chrono::steady_clock::now()-start).count();
+    return out;
+}
+void uploadTextureLayer(int layer, const DecodedImage& img, const char* filename){
+    if(!img.data){ cout<<"Using tint colour for: "<<filename<<"\n"; return; }
+    auto start = chrono::steady_clock::now();
+    glBindTexture(GL_TEXTURE_2D_ARRAY,bodyTextureArray);
+    glPixelStorei(GL_UNPACK_ALIGNMENT,1);
+    glTexSubImage3D(GL_TEXTURE_2D_ARRAY,0,0,0,layer,img.w,img.h,1,GL_RGB,GL_UNSIGNED_BYTE,img.data.get());
+    for(size_t l=0;l<img.mips.size();++l)
+        glTexSubImage3D(GL_TEXTURE_2D_ARRAY,(GLint)l+1,0,0,layer,img.mips[l].w,img.mips[l].h,1,GL_RGB,GL_UNSIGNED_BYTE,img.mips[l].pixels.data());
+    glPixelStorei(GL_UNPACK_ALIGNMENT,4);
+    bodyLayerLoaded[layer] = true;
+    printf("Loaded texture: %s into layer %d (%dx%d) decode %.1f ms, resample+mips %.1f ms, upload %.1f ms\n", filename, layer,
+           img.w, img.h, img.decodeMs, img.mipMs, chrono::duration<double,milli>(chrono::steady_clock::now()-start).count());
+}
+// Points a draw at a body texture: its own 2D texture, or its layer of the array once that has arrived
+void setBodyTexture(DrawItem& d, BodyTexture t){
+    d.texture = 0; d.layer = -1;
+    if(!textureArray) d.texture = bodyTextures[t];
+    else if(bodyLayerLoaded[t]){ d.texture = bodyTextureArray; d.layer = t; }
+}
+
+// --texture-budget <MB>: body textures keep only the mip levels their bodies need on screen. The decoded chain
+// stays in host memory; levels finer than GL_TEXTURE_BASE_LEVEL are shrunk to 1x1 to give their memory back and
+// re-uploaded when a body comes closer. Over the budget, levels go least recently needed first. The body picked
+// with the 1-8 keys is brought to full detail as soon as it is picked, ahead of the follow camera.
+// Textures read from the compressed cache and the texture array stay fully resident.
+const double RESIDENCY_LINGER_S = 2.0;  // unneeded levels are kept this long before they are dropped
+const int RESIDENCY_START_WIDTH = 256;  // a texture arrives with only its levels up to this width
+const double RESIDENCY_UPLOAD_BUDGET_MS = 2.0;
+float textureBudgetMB = 0;              // 0 keeps every level resident
+struct TextureResidency {
+    struct Entry {
+        GLuint tex=0; shared_ptr<DecodedImage> image; const char* name="";
+        int base=0, levels=0;           // levels base..levels-1 are resident
+        int need=INT32_MAX;             // finest level a body asked for this frame
+        bool prefetch=false;            // wanted at full detail whatever its size on screen
+        bool prefetched=false;          // prefetch as of the last update, for adopts between frames
+        double lastUsed=0;              // last time its finest resident level was needed
+    };
+    Entry entries[BODY_TEXTURE_COUNT];
+    size_t residentBytes=0;
+    double lastUpdate=0;                // when the last update ran; textures used then have lastUsed==lastUpdate
+
+    bool enabled() const { return textureBudgetMB>0; }
+    size_t budgetBytes() const { return (size_t)(textureBudgetMB*1024*1024); }
+    static DecodedImage::Level level(const Entry& e, int l, const unsigned char*& pixels){
+        if(l==0){ pixels = e.image->data.get(); return { e.image->w, e.image->h, {} }; }
+        pixels = e.image->mips[l-1].pixels.data(); return { e.image->mips[l-1].w, e.image->mips[l-1].h, {} };
+    }
+    static size_t levelBytes(const Entry& e, int l){ const unsigned char* p; auto lv = level(e,l,p); return (size_t)lv.w*lv.h*4; } // drivers pad RGB
+    static GLenum format(const Entry& e){ int c = e.image->channels; return c==4 ? GL_RGBA : c==3 ? GL_RGB : c==2 ? GL_RG : GL_RED; }
+
+    void uploadLevel(Entry& e, int l){
+        const unsigned char* p; auto lv = level(e,l,p);
+        glTexImage2D(GL_TEXTURE_2D,l,format(e),lv.w,lv.h,0,format(e),GL_UNSIGNED_BYTE,p);
+        residentBytes += levelBytes(e,l);
+    }
+    void setBase(Entry& e, int base){ e.base = base; glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_BASE_LEVEL,base); }
+
+    // GL thread: takes over a freshly decoded texture and uploads its coarse levels
+    void adopt(BodyTexture t, GLuint tex, shared_ptr<DecodedImage> img, const char* name){
+        if(!img->data){ cout<<"Using fallback texture for: "<<name<<"\n"; return; }
+        Entry& e = entries[t];
+        e.tex = tex; e.image = std::move(img); e.name = name; e.levels = (int)e.image->mips.size()+1;
+        int base = 0;
+        for(const unsigned char* p; base<e.levels-1 && level(e,base,p).w>RESIDENCY_START_WIDTH; ) ++base;
+        // Make room like update does, evicting levels of textures no body needed in the last update first,
+        // and start coarser if that is not enough. The coarsest level always goes up so the texture is
+        // never incomplete.
+        size_t bytes = 0;
+        for(int l=base;l<e.levels;++l) bytes += levelBytes(e,l);
+        Entry* victim;
+        while(residentBytes+bytes>budgetBytes() && (victim = lruVictim(&e,lastUpdate))) dropLevel(*victim);
+        for(; base<e.levels-1 && residentBytes+bytes>budgetBytes(); ++base) bytes -= levelBytes(e,base);
+        glBindTexture(GL_TEXTURE_2D,tex);
+        glPixelStorei(GL_UNPACK_ALIGNMENT,1);
+        for(int l=base;l<e.levels;++l) uploadLevel(e,l);
+        glPixelStorei(GL_UNPACK_ALIGNMENT,4);
+        glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MAX_LEVEL,e.levels-1);
+        setBase(e,base);
+        e.lastUsed = glfwGetTime();
+        printf("Loaded texture: %s (%dx%d, %d levels, resident from level %d) decode %.1f ms, mips %.1f ms\n", name,
+               e.image->w, e.image->h, e.levels, base, e.image->decodeMs, e.image->mipMs);
+    }
+    // A body using texture t covers radiusPx on screen; its texture should have about one texel per pixel
+    // at the centre of the disc, which needs 2*pi*radius texels around the equator
+    void request(BodyTexture t, float radiusPx){
+        Entry& e = entries[t];
+        if(!e.image) return;
+        float wanted = 6.2832f*radiusPx;
+        int l = 0;
+        for(const unsigned char* p; l<e.levels-1 && level(e,l+1,p).w>=wanted; ) ++l;
+        e.need = std::min(e.need,l);
+    }
+    void prefetch(BodyTexture t){ entries[t].prefetch = true; }
+    // Least recently needed texture other than keep that has a level it did not need at time now
+    // and is not prefetched, this frame or the last
+    Entry* lruVictim(const Entry* keep, double now){
+        Entry* victim = nullptr;
+        for(Entry& o: entries)
+            if(&o!=keep && o.image && !o.prefetch && !o.prefetched && o.base<o.levels-1 && o.lastUsed<now && (!victim || o.lastUsed<victim->lastUsed)) victim = &o;
+        return victim;
+    }
+    void dropLevel(Entry& e){
+        glBindTexture(GL_TEXTURE_2D,e.tex);
+        unsigned char texel[4] = {};
+        glTexImage2D(GL_TEXTURE_2D,e.base,format(e),1,1,0,format(e),GL_UNSIGNED_BYTE,texel); // outside base..max, never sampled
+        residentBytes -= levelBytes(e,e.base);
+        setBase(e,e.base+1);
+    }
+    // Once per frame after the draws have made their requests: drops levels that have gone unneeded, then
+    // uploads missing ones (prefetch first, then the blurriest) for as long as the upload budget lasts
+    void update(double now){
+        if(!enabled()) return;
+        vector<Entry*> raise;
+        for(Entry& e: entries){
+            if(!e.image) continue;
+            int target = e.prefetch ? 0 : std::min(e.need, e.levels-1);
+            if(target<=e.base) e.lastUsed = now;
+            if(target>e.base && now-e.lastUsed>RESIDENCY_LINGER_S) dropLevel(e);
+            else if(target<e.base) raise.push_back(&e);
+            e.need = target; // kept for the sort below, reset at the end
+        }
+        stable_sort(raise.begin(),raise.end(),[](const Entry* a, const Entry* b){
+            if(a->prefetch!=b->prefetch) return a->prefetch;
+            return a->base-a->need > b->base-b->need;
+        });
+        auto start = chrono::steady_clock::now();
+        glPixelStorei(GL_UNPACK_ALIGNMENT,1);
+        for(Entry* e: raise){
+            while(e->need<e->base && chrono::duration<double,milli>(chrono::steady_clock::now()-start).count()<RESIDENCY_UPLOAD_BUDGET_MS){
+                size_t bytes = levelBytes(*e,e->base-1);
+                Entry* victim;
+                while(residentBytes+bytes>budgetBytes() && (victim = lruVictim(e,now))) dropLevel(*victim);
+                if(residentBytes+bytes>budgetBytes()) break; // everything resident is in use; stay coarser
+                glBindTexture(GL_TEXTURE_2D,e->tex);
+                uploadLevel(*e,e->base-1);
+                setBase(*e,e->base-1);
+            }
+        }
+        glPixelStorei(GL_UNPACK_ALIGNMENT,4);
+        for(Entry& e: entries){ e.need = INT32_MAX; e.prefetched = e.prefetch; e.prefetch = false; }
+        lastUpdate = now;
+        glState.invalidateBindings();
+        frameStats.textureMB = residentBytes/(1024.0f*1024.0f);
+    }
+};
+TextureResidency textureResidency;
 
 vector<float> createTexturedSphere(float radius, vec3 color){
     vector<float> v; const int seg=30, ring=20;
@@ -423,16 +1941,69 @@ vector<float> createTexturedSphere(float radius, vec3 color){
     }
     return v;
 }
-int createTexturedSphereVBO(vector<float>& s){
-    GLuint VBO,VAO; glGenVertexArrays(1,&VAO); glGenBuffers(1,&VBO);
-    glBindVertexArray(VAO); glBindBuffer(GL_ARRAY_BUFFER,VBO);
-    glBufferData(GL_ARRAY_BUFFER,s.size()*sizeof(float),s.data(),GL_STATIC_DRAW);
-    glVertexAttribPointer(0,3,GL_FLOAT,GL_FALSE,11*sizeof(float),(void*)0); glEnableVertexAttribArray(0);
-    glVertexAttribPointer(1,3,GL_FLOAT,GL_FALSE,11*sizeof(float),(void*)(3*sizeof(float))); glEnableVertexAttribArray(1);
-    glVertexAttribPointer(2,2,GL_FLOAT,GL_FALSE,11*sizeof(float),(void*)(6*sizeof(float))); glEnableVertexAttribArray(2);
-    glVertexAttribPointer(3,3,GL_FLOAT,GL_FALSE,11*sizeof(float),(void*)(8*sizeof(float))); glEnableVertexAttribArray(3);
-    return VAO;
+// Indexed unit UV sphere sharing every corner between its quads: (seg+1)*(ring+1) vertices, the seam column
+// duplicated for UVs, and the triangles that collapse at the poles left out. 16-bit indices.
+// Bodies scale it by their radius in the world matrix and pass their colour as a tint.
+void buildIndexedSphere(Mesh& m, int seg=30, int ring=20){
+    m.vertices.clear(); m.indices.clear();
+    m.vertices.reserve((seg+1)*(ring+1));
+    m.indices.reserve(seg*(ring-1)*6);
+    for(int i=0;i<=ring;++i){
+        float t=float(i)/ring*M_PI, st=sin(t), ct=cos(t);
+        for(int j=0;j<=seg;++j){
+            float p=float(j)/seg*2.f*M_PI;
+            vec3 n(st*cos(p), ct, st*sin(p));
+            m.vertices.push_back({n, vec2(float(j)/seg,float(i)/ring), n});
+        }
+    }
+    auto idx=[&](int i,int j){ return (unsigned)(i*(seg+1)+j); };
+    for(int i=0;i<ring;++i){
+        for(int j=0;j<seg;++j){
+            unsigned a=idx(i,j), b=idx(i,j+1), c=idx(i+1,j), d=idx(i+1,j+1);
+            if(i>0)      m.indices.insert(m.indices.end(),{a,b,c});
+            if(i<ring-1) m.indices.insert(m.indices.end(),{b,d,c});
+        }
+    }
+    m.indexType = GL_UNSIGNED_SHORT;
+}
+Mesh createIndexedSphere(int seg=30, int ring=20){
+    Mesh m; buildIndexedSphere(m,seg,ring);
+    string name = "Sphere "+to_string(seg)+"x"+to_string(ring);
+    optimizeMesh(m, name.c_str());
+    m.upload();
+    return m;
+}
+
+// --bench-sphere: vertex shader work and memory of the unindexed vs indexed sphere, no GL needed
+void benchSphere(){
+    const int tess[][2] = { {30,20}, {64,48}, {128,96} };
+    cout<<"tessellation  path       vertices  indices  VS invocations  bytes\n";
+    for(auto& t: tess){
+        int seg=t[0], ring=t[1];
+        size_t flat = (size_t)seg*ring*6; // what createTexturedSphere emits at this tessellation
+        Mesh m; buildIndexedSphere(m,seg,ring);
+        auto row=[&](const char* path){
+            printf("%4dx%-4d     %-9s  %8zu  %7zu  %14zu  %zu\n", seg, ring, path, m.vertices.size(), m.indices.size(),
+                   simulateVertexCache(m.indices,32), m.vertexBytes()+m.indexBytes());
+        };
+        printf("%4dx%-4d     unindexed  %8zu  %7s  %14zu  %zu\n", seg, ring, flat, "-", flat, flat*11*sizeof(float));
+        row("indexed");
+        optimizeMesh(m); // what the renderer uploads: reordered, with vertices no triangle uses dropped
+        row("optimized");
+    }
+    const int runs = 100;
+    auto start = chrono::steady_clock::now();
+    for(int r=0;r<runs;++r) createTexturedSphere(1.0f,vec3(1));
+    double flatMs = chrono::duration<double,milli>(chrono::steady_clock::now()-start).count()/runs;
+    Mesh m;
+    start = chrono::steady_clock::now();
+    for(int r=0;r<runs;++r) buildIndexedSphere(m);
+    double indexedMs = chrono::duration<double,milli>(chrono::steady_clock::now()-start).count()/runs;
+    printf("30x20 build time: unindexed %.3f ms, indexed %.3f ms\n", flatMs, indexedMs);
+    cout<<"indexed is buildIndexedSphere's output, optimized the same after optimizeMesh as drawn.\n"
+          "VS invocations for the indexed paths assume a 32-entry FIFO post-transform cache.\n";
 }
+
 vector<vec3> createOrbitPath(float r){
     vector<vec3> v; const int seg=100; vec3 col(0.3f);
     for(int i=0;i<=seg;++i){ float a=float(i)/seg*2.f*M_PI; vec3 p(r*cos(a),0,r*sin(a)); v.push_back(p); v.push_back(col); }
@@ -446,42 +2017,724 @@ int createOrbitVBO(vector<vec3>& v){
     glVertexAttribPointer(1,3,GL_FLOAT,GL_FALSE,6*sizeof(float),(void*)(3*sizeof(float))); glEnableVertexAttribArray(1);
     return VAO;
 }
-vector<float> createRing(float innerR,float outerR, vec3 color){
-    vector<float> v; const int seg=60; vec3 n(0,1,0);
+// Flat annulus with outer radius 1, scaled per draw like the sphere. One mesh per inner/outer ratio.
+void buildUnitRing(Mesh& m, float innerRatio, int seg=60){
+    m.vertices.clear(); m.indices.clear();
+    vec3 n(0,1,0);
+    for(int i=0;i<=seg;++i){
+        float a=float(i)/seg*2.f*M_PI; vec3 dir(cos(a),0,sin(a));
+        m.vertices.push_back({dir, vec2(float(i)/seg,1), n});
+        m.vertices.push_back({dir*innerRatio, vec2(float(i)/seg,0), n});
+    }
     for(int i=0;i<seg;++i){
-        float a1=float(i)/seg*2.f*M_PI, a2=float(i+1)/seg*2.f*M_PI;
-        vec3 v1(outerR*cos(a1),0,outerR*sin(a1)), v2(innerR*cos(a1),0,innerR*sin(a1));
-        vec3 v3(outerR*cos(a2),0,outerR*sin(a2)), v4(innerR*cos(a2),0,innerR*sin(a2));
-        vec2 t1(float(i)/seg,1), t2(float(i)/seg,0), t3(float(i+1)/seg,1), t4(float(i+1)/seg,0);
-        auto push=[&](vec3 P, vec2 UV){ v.insert(v.end(),{P.x,P.y,P.z, color.x,color.y,color.z, UV.x,UV.y, n.x,n.y,n.z}); };
-        push(v1,t1); push(v2,t2); push(v3,t3); push(v2,t2); push(v4,t4); push(v3,t3);
+        unsigned o1=2*i, i1=2*i+1, o2=2*i+2, i2=2*i+3;
+        m.indices.insert(m.indices.end(),{o1,i1,o2, i1,i2,o2});
+    }
+    m.indexType = GL_UNSIGNED_SHORT;
+}
+map<float,Mesh> ringMeshes;
+const Mesh* sharedRingMesh(float innerRatio){
+    auto it = ringMeshes.find(innerRatio);
+    if(it==ringMeshes.end()){
+        it = ringMeshes.emplace(innerRatio,Mesh()).first;
+        buildUnitRing(it->second,innerRatio); optimizeMesh(it->second); it->second.upload();
+    }
+    return &it->second;
+}
+
+// Every planet, moon and the sun draw from this one LOD chain of unit spheres. Each body keeps its current
+// level and moves only when its projected size leaves that level's band by the hysteresis margin,
+// so bodies near a threshold do not flicker between levels.
+const int SPHERE_LOD_COUNT = 5;
+const int SPHERE_LOD_DIMS[SPHERE_LOD_COUNT][2] = { {8,6}, {16,12}, {32,24}, {64,48}, {128,96} };
+const float SPHERE_LOD_EDGE_PX = 12.0f;   // target on-screen length of an equator edge
+const float SPHERE_LOD_HYSTERESIS = 0.2f; // in levels
+Mesh sphereLods[SPHERE_LOD_COUNT];
+float lodBias = 0.0f;                     // positive = coarser, in levels
+bool useProceduralSpheres = false;        // --procedural-spheres: build the LOD's vertices in VS_MAIN instead
+bool runSphereRenderBench = false;        // --bench-sphere-render
+
+const float FOV_Y = 45.0f;
+int currentWindowWidth = WINDOW_WIDTH;
+int currentWindowHeight = WINDOW_HEIGHT;
+
+// Screen-space radius in pixels of a sphere seen from the eye
+float projectedRadiusPx(vec3 center, float radius, vec3 eye){
+    float d = length(center-eye);
+    if(d<=radius) return 1e6f;
+    return radius / (sqrt(d*d-radius*radius) * tan(radians(FOV_Y)*0.5f)) * (currentWindowHeight*0.5f);
+}
+// Bodies smaller than this on screen (radius in pixels) are drawn as ray-cast impostors; 0 disables them
+float impostorThresholdPx = 4.0f;
+
+int selectSphereLod(int& level, float radiusPx){
+    float segs = 2.0f*(float)M_PI*radiusPx / SPHERE_LOD_EDGE_PX;
+    float lodf = log2(std::max(segs,1.0f)/SPHERE_LOD_DIMS[0][0]) - lodBias;
+    int want = glm::clamp((int)ceil(lodf), 0, SPHERE_LOD_COUNT-1);
+    if(level<0 || lodf > level+SPHERE_LOD_HYSTERESIS || lodf < level-1-SPHERE_LOD_HYSTERESIS) level = want;
+    return level;
+}
+// Coarsest level whose deviation stays under MESH_LOD_ERROR_PX at this on-screen radius of the bounds
+int selectMeshLod(const Mesh& m, float radiusPx){
+    if(m.boundRadius<=0.0f) return 0;
+    float pxPerUnit = radiusPx/m.boundRadius, allowed = MESH_LOD_ERROR_PX*exp2(lodBias);
+    for(int l=m.lodCount()-1; l>0; --l) if(m.lods[l].error*pxPerUnit <= allowed) return l;
+    return 0;
+}
+
+// --bench-sphere-render: a grid of lit spheres per LOD level, drawn from the index buffers and from gl_VertexID.
+// Prints the renderer so runs can be compared; LIBGL_ALWAYS_SOFTWARE=1 selects Mesa's software rasteriser.
+void benchSphereRender(const MainUniforms (*programs)[MAIN_VARIANT_COUNT]){
+    cout<<"GL_RENDERER: "<<glGetString(GL_RENDERER)<<"\n";
+    const int grid = 20, frames = 30;
+    FrameData fd;
+    fd.viewMatrix = lookAt(vec3(0,0,30), vec3(0), vec3(0,1,0));
+    fd.projectionMatrix = perspective(radians(FOV_Y),(float)currentWindowWidth/(float)currentWindowHeight,0.1f,100.0f);
+    fd.viewPos = vec4(0,0,30,1); fd.sunPosition = vec4(0,10,60,1); fd.lightColor = vec4(1);
+    updateFrameData(fd);
+    GLuint query; glGenQueries(1,&query);
+    glState.invalidateBindings();
+    cout<<"tessellation  path        spheres  triangles/frame  GPU ms/frame  wall ms/frame\n";
+    for(int l=0;l<SPHERE_LOD_COUNT;++l){
+        for(DrawPath path: {PATH_MESH, PATH_PROCEDURAL_SPHERE}){
+            vector<DrawItem> draws;
+            for(int y=0;y<grid;++y) for(int x=0;x<grid;++x){
+                DrawItem d;
+                d.variant = VARIANT_LIT; d.tint = vec3(0.8f); d.path = path; d.mesh = &sphereLods[l];
+                d.sphereTess[0] = SPHERE_LOD_DIMS[l][0]; d.sphereTess[1] = SPHERE_LOD_DIMS[l][1];
+                d.world = translate(mat4(1), vec3(x-grid*0.5f+0.5f, y-grid*0.5f+0.5f, 0)) * scale(mat4(1), vec3(0.45f));
+                draws.push_back(d);
+            }
+            double gpuMs = 0, wallMs = 0; long long tris = 0;
+            for(int f=-2;f<frames;++f){ // two warm-up frames
+                glClear(GL_COLOR_BUFFER_BIT|GL_DEPTH_BUFFER_BIT);
+                glFinish();
+                auto start = chrono::steady_clock::now();
+                glBeginQuery(GL_TIME_ELAPSED,query);
+                submitDraws(draws, programs);
+                glEndQuery(GL_TIME_ELAPSED);
+                glFinish();
+                GLuint64 ns = 0; glGetQueryObjectui64v(query,GL_QUERY_RESULT,&ns);
+                if(f>=0){ gpuMs += ns*1e-6; wallMs += chrono::duration<double,milli>(chrono::steady_clock::now()-start).count(); }
+                tris = frameStats.triangles; frameStats = FrameStats();
+            }
+            printf("%4dx%-4d     %-10s  %7d  %15lld  %12.3f  %13.3f\n", SPHERE_LOD_DIMS[l][0], SPHERE_LOD_DIMS[l][1],
+                   path==PATH_MESH ? "vbo" : "procedural", grid*grid, tris, gpuMs/frames, wallMs/frames);
+        }
     }
+    glDeleteQueries(1,&query);
+}
+
+// Packed star vertex, 8 bytes: the direction octahedral-encoded in two snorm16 (every star lies at
+// STAR_FIELD_RADIUS, which VS_STAR takes from a uniform), RGB8 colour and 8-bit brightness in alpha
+struct StarVertex { int16_t dir[2]; uint8_t rgba[4]; };
+StarVertex packStar(vec3 dir, vec3 color, float brightness){
+    StarVertex v;
+    vec2 e = octEncode(dir);
+    for(int k=0;k<2;++k) v.dir[k] = (int16_t)(e[k]*32767.0f + (e[k]<0.0f ? -0.5f : 0.5f)); // |e| <= 1, round half away
+    for(int k=0;k<3;++k) v.rgba[k] = (uint8_t)(glm::clamp(color[k],0.0f,1.0f)*255.0f+0.5f);
+    v.rgba[3] = (uint8_t)(glm::clamp(brightness,0.0f,1.0f)*255.0f+0.5f);
     return v;
 }
 
-void createStarfield(int& program){
-    program = linkProgram(VS_STAR, FS_STAR);
-    vector<float> V; V.reserve(STAR_COUNT*7);
-    random_device rd; mt19937 g(rd());
-    uniform_real_distribution<> dis(-1.0,1.0), bright(0.2,1.0), colVar(0.7,1.0), type(0.0,1.0);
-    for(int i=0;i<STAR_COUNT;++i){
-        vec3 dir = normalize(vec3(dis(g),dis(g),dis(g)));
-        vec3 pos = dir * (float)STAR_FIELD_RADIUS;
-        float t = type(g); float r,gc,b;
-        if(t<0.7){ r=colVar(g); gc=colVar(g); b=colVar(g)*1.1f; }
-        else if(t<0.85){ r=0.9f+colVar(g)*0.1f; gc=0.7f+colVar(g)*0.3f; b=0.4f+colVar(g)*0.2f; }
-        else if(t<0.95){ r=0.8f+colVar(g)*0.2f; gc=0.3f+colVar(g)*0.3f; b=0.2f+colVar(g)*0.2f; }
-        else{ r=0.4f+colVar(g)*0.2f; gc=0.6f+colVar(g)*0.3f; b=0.9f+colVar(g)*0.1f; }
-        float br=bright(g);
-        V.insert(V.end(),{pos.x,pos.y,pos.z, r,gc,b, br});
+// Starfield randomness is Philox4x32-10 (Salmon et al., "Parallel random numbers: as easy as 1, 2, 3"): a keyed
+// bijection of a 128-bit counter. Star i takes the two blocks at counters (i,0) and (i,1), so any range of
+// stars can be generated on its own and the field is the same for a seed whatever the threads or lanes.
+int starCount = 50000;                    // --star-count
+uint64_t starSeed = 0x5eed;               // --seed
+const uint32_t PHILOX_M0 = 0xD2511F53u, PHILOX_M1 = 0xCD9E8D57u, PHILOX_W0 = 0x9E3779B9u, PHILOX_W1 = 0xBB67AE85u;
+
+void philox4x32(uint32_t c[4], uint64_t seed){
+    uint32_t k0 = (uint32_t)seed, k1 = (uint32_t)(seed>>32);
+    for(int round=0; round<10; ++round){
+        uint64_t p0 = (uint64_t)PHILOX_M0*c[0], p1 = (uint64_t)PHILOX_M1*c[2];
+        uint32_t n0 = (uint32_t)(p1>>32)^c[1]^k0, n2 = (uint32_t)(p0>>32)^c[3]^k1;
+        c[0] = n0; c[1] = (uint32_t)p1; c[2] = n2; c[3] = (uint32_t)p0;
+        k0 += PHILOX_W0; k1 += PHILOX_W1;
+    }
+}
+#ifdef HAVE_SSE2
+// Four counters side by side, c[word] holding that word of each; bit-identical to philox4x32 per lane
+void philox4x32x4(__m128i c[4], uint64_t seed){
+    uint32_t k0 = (uint32_t)seed, k1 = (uint32_t)(seed>>32);
+    const __m128i m0 = _mm_set1_epi32((int)PHILOX_M0), m1 = _mm_set1_epi32((int)PHILOX_M1);
+    auto mulhilo = [](__m128i a, __m128i m, __m128i& hi){
+        __m128i even = _mm_mul_epu32(a,m), odd = _mm_mul_epu32(_mm_srli_epi64(a,32),m); // lanes 0,2 and 1,3
+        hi = _mm_unpacklo_epi32(_mm_shuffle_epi32(even,_MM_SHUFFLE(3,3,3,1)), _mm_shuffle_epi32(odd,_MM_SHUFFLE(3,3,3,1)));
+        return _mm_unpacklo_epi32(_mm_shuffle_epi32(even,_MM_SHUFFLE(2,2,2,0)), _mm_shuffle_epi32(odd,_MM_SHUFFLE(2,2,2,0)));
+    };
+    for(int round=0; round<10; ++round){
+        __m128i hi0, hi1;
+        __m128i lo0 = mulhilo(c[0],m0,hi0), lo1 = mulhilo(c[2],m1,hi1);
+        c[0] = _mm_xor_si128(_mm_xor_si128(hi1,c[1]),_mm_set1_epi32((int)k0));
+        c[2] = _mm_xor_si128(_mm_xor_si128(hi0,c[3]),_mm_set1_epi32((int)k1));
+        c[1] = lo1; c[3] = lo0;
+        k0 += PHILOX_W0; k1 += PHILOX_W1;
+    }
+}
+#endif
+inline float unitFloat(uint32_t u){ return (u>>8)*(1.0f/16777216.0f); } // [0,1) from the top 24 bits
+
+// One star from its eight random words, with the distributions the field has always used. The maths is spelt
+// out operation by operation, as starsFromRandom4 does it four lanes at a time, so both give the same bits.
+// Contraction is off for both: on FMA targets (-march=haswell) the compiler would otherwise fuse some a*b+c,
+// intrinsics included, into one rounding, and the two would no longer agree.
+// White 70%, yellow 15%, orange 10% and blue 5%: colour = base + scale * (0.7..1) per channel
+const float STAR_COLOR_BASE[4][3]  = { {0,0,0}, {0.9f,0.7f,0.4f}, {0.8f,0.3f,0.2f}, {0.4f,0.6f,0.9f} };
+const float STAR_COLOR_SCALE[4][3] = { {1,1,1.1f}, {0.1f,0.3f,0.2f}, {0.2f,0.3f,0.2f}, {0.2f,0.3f,0.1f} };
+const float STAR_TYPE_AT[3] = { 0.7f, 0.85f, 0.95f };
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC push_options
+#pragma GCC optimize("fp-contract=off")
+#elif defined(_MSC_VER)
+#pragma fp_contract(off)
+#endif
+StarVertex starFromRandom(const uint32_t r[8]){
+#ifdef __clang__
+#pragma clang fp contract(off)
+#endif
+    auto in = [&](int k, float lo, float hi){ return lo + (hi-lo)*unitFloat(r[k]); };
+    float x = in(0,-1,1), y = in(1,-1,1), z = in(2,-1,1);
+    float len = sqrtf(x*x + y*y + z*z);
+    x = x/len; y = y/len; z = z/len;
+    // octahedral encoding, as octEncode
+    float l1 = fabsf(x) + fabsf(y) + fabsf(z);
+    float ex = x/l1, ey = y/l1;
+    if(z/l1<0.0f){
+        float fx = (1.0f-fabsf(ey))*(ex>=0.0f ? 1.0f : -1.0f), fy = (1.0f-fabsf(ex))*(ey>=0.0f ? 1.0f : -1.0f);
+        ex = fx; ey = fy;
+    }
+    float t = unitFloat(r[3]);
+    int type = (t>=STAR_TYPE_AT[0]) + (t>=STAR_TYPE_AT[1]) + (t>=STAR_TYPE_AT[2]);
+    StarVertex v;
+    v.dir[0] = (int16_t)(int)(ex*32767.0f + (ex<0.0f ? -0.5f : 0.5f));
+    v.dir[1] = (int16_t)(int)(ey*32767.0f + (ey<0.0f ? -0.5f : 0.5f));
+    for(int k=0;k<3;++k){
+        float c = STAR_COLOR_BASE[type][k] + STAR_COLOR_SCALE[type][k]*in(4+k,0.7f,1);
+        v.rgba[k] = (uint8_t)(int)(std::min(std::max(c,0.0f),1.0f)*255.0f + 0.5f);
+    }
+    v.rgba[3] = (uint8_t)(int)(in(7,0.2f,1)*255.0f + 0.5f);
+    return v;
+}
+#ifdef HAVE_SSE2
+// starFromRandom for four stars, r[k] holding word k of each
+void starsFromRandom4(const __m128i r[8], StarVertex out[4]){
+#ifdef __clang__
+#pragma clang fp contract(off)
+#endif
+    auto in = [&](int k, float lo, float hi){
+        __m128 u = _mm_mul_ps(_mm_cvtepi32_ps(_mm_srli_epi32(r[k],8)), _mm_set1_ps(1.0f/16777216.0f));
+        return _mm_add_ps(_mm_set1_ps(lo), _mm_mul_ps(_mm_set1_ps(hi-lo), u));
+    };
+    const __m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff)), signBit = _mm_castsi128_ps(_mm_set1_epi32((int)0x80000000u));
+    auto select = [](__m128 mask, __m128 a, __m128 b){ return _mm_or_ps(_mm_and_ps(mask,a), _mm_andnot_ps(mask,b)); }; // mask ? a : b
+    __m128 x = in(0,-1,1), y = in(1,-1,1), z = in(2,-1,1);
+    __m128 len = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(x,x),_mm_mul_ps(y,y)),_mm_mul_ps(z,z)));
+    x = _mm_div_ps(x,len); y = _mm_div_ps(y,len); z = _mm_div_ps(z,len);
+    __m128 l1 = _mm_add_ps(_mm_add_ps(_mm_and_ps(x,absMask),_mm_and_ps(y,absMask)),_mm_and_ps(z,absMask));
+    __m128 ex = _mm_div_ps(x,l1), ey = _mm_div_ps(y,l1);
+    __m128 lower = _mm_cmplt_ps(_mm_div_ps(z,l1),_mm_setzero_ps());
+    const __m128 one = _mm_set1_ps(1.0f);
+    __m128 sx = _mm_or_ps(one,_mm_and_ps(_mm_cmplt_ps(ex,_mm_setzero_ps()),signBit)); // signNotZero
+    __m128 sy = _mm_or_ps(one,_mm_and_ps(_mm_cmplt_ps(ey,_mm_setzero_ps()),signBit));
+    __m128 fx = _mm_mul_ps(_mm_sub_ps(one,_mm_and_ps(ey,absMask)),sx), fy = _mm_mul_ps(_mm_sub_ps(one,_mm_and_ps(ex,absMask)),sy);
+    ex = select(lower,fx,ex); ey = select(lower,fy,ey);
+    auto snorm = [&](__m128 e){
+        __m128 half = _mm_or_ps(_mm_set1_ps(0.5f),_mm_and_ps(_mm_cmplt_ps(e,_mm_setzero_ps()),signBit));
+        return _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(e,_mm_set1_ps(32767.0f)),half));
+    };
+    __m128i dir = _mm_or_si128(_mm_and_si128(snorm(ex),_mm_set1_epi32(0xffff)), _mm_slli_epi32(snorm(ey),16));
+    __m128 t = _mm_mul_ps(_mm_cvtepi32_ps(_mm_srli_epi32(r[3],8)), _mm_set1_ps(1.0f/16777216.0f));
+    __m128 at[3];
+    for(int j=0;j<3;++j) at[j] = _mm_cmpge_ps(t,_mm_set1_ps(STAR_TYPE_AT[j]));
+    auto byte = [&](__m128 c){
+        c = _mm_min_ps(_mm_max_ps(c,_mm_setzero_ps()),one);
+        return _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(c,_mm_set1_ps(255.0f)),_mm_set1_ps(0.5f)));
+    };
+    __m128i rgba = _mm_slli_epi32(byte(in(7,0.2f,1)),24);
+    for(int k=0;k<3;++k){
+        __m128 base = _mm_set1_ps(STAR_COLOR_BASE[0][k]), scale = _mm_set1_ps(STAR_COLOR_SCALE[0][k]);
+        for(int j=0;j<3;++j){
+            base = select(at[j],_mm_set1_ps(STAR_COLOR_BASE[j+1][k]),base);
+            scale = select(at[j],_mm_set1_ps(STAR_COLOR_SCALE[j+1][k]),scale);
+        }
+        rgba = _mm_or_si128(rgba,_mm_slli_epi32(byte(_mm_add_ps(base,_mm_mul_ps(scale,in(4+k,0.7f,1)))),8*k));
+    }
+    _mm_storeu_si128((__m128i*)out,_mm_unpacklo_epi32(dir,rgba));
+    _mm_storeu_si128((__m128i*)(out+2),_mm_unpackhi_epi32(dir,rgba));
+}
+#endif
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC pop_options
+#endif
+// Stars [first,last) of the field for seed; simd runs four stars per step where SSE2 is available
+void generateStars(StarVertex* out, size_t first, size_t last, uint64_t seed, bool simd=true){
+    size_t i = first;
+#ifdef HAVE_SSE2
+    for(; simd && i+4<=last; i+=4){
+        __m128i r[8];
+        for(uint32_t block=0; block<2; ++block){
+            __m128i c[4] = { _mm_set_epi32((int)(i+3),(int)(i+2),(int)(i+1),(int)i),
+                             _mm_set_epi32((int)((uint64_t)(i+3)>>32),(int)((uint64_t)(i+2)>>32),(int)((uint64_t)(i+1)>>32),(int)((uint64_t)i>>32)),
+                             _mm_set1_epi32((int)block), _mm_setzero_si128() };
+            philox4x32x4(c,seed);
+            for(int w=0;w<4;++w) r[block*4+w] = c[w];
+        }
+        starsFromRandom4(r, out+(i-first));
+    }
+#else
+    (void)simd;
+#endif
+    for(; i<last; ++i){
+        uint32_t words[8];
+        for(uint32_t block=0; block<2; ++block){
+            uint32_t c[4] = { (uint32_t)i, (uint32_t)((uint64_t)i>>32), block, 0 };
+            philox4x32(c,seed);
+            memcpy(words+block*4,c,sizeof(c));
+        }
+        out[i-first] = starFromRandom(words);
+    }
+}
+// Where thread t of threads starts on count stars. Multiples of four, so only the field's last stars take
+// the scalar path and the split never decides which stars the four-lane one builds.
+size_t starChunkStart(size_t count, int t, int threads){ return t==threads ? count : count*t/threads & ~(size_t)3; }
+// CPU half of the starfield, safe on a worker thread
+vector<StarVertex> generateStarfield(int threads=0){
+    vector<StarVertex> V(starCount);
+    if(threads<=0) threads = (int)std::max(1u, thread::hardware_concurrency());
+    threads = std::max(1, std::min(threads, starCount/65536+1)); // a thread per 64k stars at most
+    parallelFor(threads,[&](int t){
+        size_t first = starChunkStart(starCount,t,threads), last = starChunkStart(starCount,t+1,threads);
+        generateStars(V.data()+first, first, last, starSeed);
+    });
+    return V;
+}
+// Stars per second for the scalar and four-lane generators and all cores, up to 10M stars;
+// the output must hash the same every way
+void benchStarfield(){
+    int cores = (int)std::max(1u, thread::hardware_concurrency());
+    printf("Starfield generation, seed %llu (Philox4x32-10)\n", (unsigned long long)starSeed);
+    for(int count: {50000, 1000000, 10000000}){
+        vector<StarVertex> V(count);
+        uint64_t reference = 0;
+        struct Way { const char* name; bool simd; int threads; };
+        vector<Way> ways = { {"scalar, 1 thread",false,1} };
+#ifdef HAVE_SSE2
+        ways.push_back({"SSE2 x4, 1 thread",true,1});
+#endif
+        if(cores>1) ways.push_back({"all threads",true,cores});
+        for(const Way& w: ways){
+            double best = 1e30;
+            for(int run=0; run<(count>1000000 ? 2 : 5); ++run){
+                auto start = chrono::steady_clock::now();
+                parallelFor(w.threads,[&](int t){
+                    size_t first = starChunkStart(count,t,w.threads), last = starChunkStart(count,t+1,w.threads);
+                    generateStars(V.data()+first, first, last, starSeed, w.simd);
+                });
+                best = std::min(best, chrono::duration<double,milli>(chrono::steady_clock::now()-start).count());
+            }
+            uint64_t h = fnv1a(V.data(), V.size()*sizeof(StarVertex));
+            if(!reference) reference = h;
+            printf("  %8d stars, %-18s %8.2f ms  %7.2f M stars/s  %s\n", count, w.name, best, count/(best*1000.0),
+                   h==reference ? "same output" : "OUTPUT DIFFERS");
+        }
     }
+}
+// Orders the stars by brightness and returns the sorted brightnesses
+vector<float> sortStarsByBrightness(vector<StarVertex>& V){
+    stable_sort(V.begin(),V.end(),[](const StarVertex& a, const StarVertex& b){ return a.rgba[3]<b.rgba[3]; });
+    vector<float> bright(V.size());
+    for(size_t i=0;i<V.size();++i) bright[i] = V[i].rgba[3]/255.0f;
+    return bright;
+}
+void uploadStarfield(const StarVertex* V, size_t count){
     GLuint VBO; glGenVertexArrays(1,&starfieldVAO); glGenBuffers(1,&VBO);
     glBindVertexArray(starfieldVAO); glBindBuffer(GL_ARRAY_BUFFER,VBO);
-    glBufferData(GL_ARRAY_BUFFER,V.size()*sizeof(float),V.data(),GL_STATIC_DRAW);
-    glVertexAttribPointer(0,3,GL_FLOAT,GL_FALSE,7*sizeof(float),(void*)0); glEnableVertexAttribArray(0);
-    glVertexAttribPointer(1,3,GL_FLOAT,GL_FALSE,7*sizeof(float),(void*)(3*sizeof(float))); glEnableVertexAttribArray(1);
-    glVertexAttribPointer(2,1,GL_FLOAT,GL_FALSE,7*sizeof(float),(void*)(6*sizeof(float))); glEnableVertexAttribArray(2);
-    starfieldVertexCount = STAR_COUNT;
+    glBufferData(GL_ARRAY_BUFFER,count*sizeof(StarVertex),V,GL_STATIC_DRAW);
+    glVertexAttribPointer(0,2,GL_SHORT,GL_TRUE,sizeof(StarVertex),(void*)offsetof(StarVertex,dir)); glEnableVertexAttribArray(0);
+    glVertexAttribPointer(1,4,GL_UNSIGNED_BYTE,GL_TRUE,sizeof(StarVertex),(void*)offsetof(StarVertex,rgba)); glEnableVertexAttribArray(1);
+    glBindVertexArray(0);
+    starfieldVertexCount = (int)count;
+}
+
+// --star-skybox: the stars sit at fixed directions, so they are drawn once into a cubemap and the frame draws
+// one fullscreen skybox instead of every point. Faces are sized so a texel is about a screen pixel at the
+// centre of the view and are rebaked when the window height or the star data changes. With
+// --skybox-bright-stars <b>, stars of brightness b and above stay points; the buffer is sorted by
+// brightness so they are a single range at its end.
+bool starSkybox = false;
+float skyboxBrightStars = 2.0f;           // above any star's brightness: everything is baked
+const int SKYBOX_MAX_FACE = 2048;
+struct StarSkybox {
+    GLuint cube=0, fbo=0;
+    int face=0;                           // edge of the baked faces, 0 before the first bake
+    int bakedStars=-1;                    // starfieldVertexCount the cube was baked from
+    int pointsFirst=0;                    // stars from here on are drawn live
+    int faceFor(int windowHeight) const {
+        return std::min(SKYBOX_MAX_FACE, (int)ceil(windowHeight / tan(radians(FOV_Y)*0.5f)));
+    }
+    bool stale(int windowHeight) const { return bakedStars!=starfieldVertexCount || face!=faceFor(windowHeight); }
+    void bake(GLuint starProgram, int windowHeight){
+        auto start = chrono::steady_clock::now();
+        if(!cube){
+            glGenTextures(1,&cube); glGenFramebuffers(1,&fbo);
+            glEnable(GL_TEXTURE_CUBE_MAP_SEAMLESS);
+        }
+        int size = faceFor(windowHeight);
+        glBindTexture(GL_TEXTURE_CUBE_MAP,cube);
+        if(size!=face){
+            for(int f=0;f<6;++f) glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X+f,0,GL_RGBA8,size,size,0,GL_RGBA,GL_UNSIGNED_BYTE,nullptr);
+            glTexParameteri(GL_TEXTURE_CUBE_MAP,GL_TEXTURE_MIN_FILTER,GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_CUBE_MAP,GL_TEXTURE_MAG_FILTER,GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_CUBE_MAP,GL_TEXTURE_MAX_LEVEL,0);
+            for(GLenum w: {GL_TEXTURE_WRAP_S,GL_TEXTURE_WRAP_T,GL_TEXTURE_WRAP_R}) glTexParameteri(GL_TEXTURE_CUBE_MAP,w,GL_CLAMP_TO_EDGE);
+            face = size;
+        }
+        // Face orientations of the GL cubemap convention
+        static const vec3 DIR[6] = { vec3(1,0,0), vec3(-1,0,0), vec3(0,1,0), vec3(0,-1,0), vec3(0,0,1), vec3(0,0,-1) };
+        static const vec3 UP[6]  = { vec3(0,-1,0), vec3(0,-1,0), vec3(0,0,1), vec3(0,0,-1), vec3(0,-1,0), vec3(0,-1,0) };
+        int stars = starfieldVertexCount;
+        if(starfieldBrightness.size()==(size_t)stars)
+            pointsFirst = (int)(lower_bound(starfieldBrightness.begin(),starfieldBrightness.end(),skyboxBrightStars)-starfieldBrightness.begin());
+        else pointsFirst = stars;
+        glBindFramebuffer(GL_FRAMEBUFFER,fbo);
+        glViewport(0,0,size,size);
+        glDisable(GL_DEPTH_TEST);
+        glState.useProgram(starProgram);
+        glState.bindVertexArray(starfieldVAO);
+        FrameData fd;
+        fd.projectionMatrix = perspective(radians(90.0f),1.0f,1.0f,STAR_FIELD_RADIUS*2.0f);
+        for(int f=0;f<6;++f){
+            glFramebufferTexture2D(GL_FRAMEBUFFER,GL_COLOR_ATTACHMENT0,GL_TEXTURE_CUBE_MAP_POSITIVE_X+f,cube,0);
+            glClearColor(0.0f,0.0f,0.05f,1.0f);
+            glClear(GL_COLOR_BUFFER_BIT);
+            fd.viewMatrix = lookAt(vec3(0), DIR[f], UP[f]);
+            updateFrameData(fd);
+            glDrawArrays(GL_POINTS,0,pointsFirst);
+        }
+        glBindFramebuffer(GL_FRAMEBUFFER,0);
+        glEnable(GL_DEPTH_TEST);
+        glState.invalidateBindings();
+        bakedStars = stars;
+        printf("Baked %d stars into a %dx%d star cubemap (%.0f MB) in %.1f ms, %d bright stars stay points\n", pointsFirst, size, size,
+               size*(double)size*6*4/(1024*1024), chrono::duration<double,milli>(chrono::steady_clock::now()-start).count(), stars-pointsFirst);
+    }
+    // After the clear, before anything that writes depth
+    void draw(GLuint skyProgram, GLuint starProgram){
+        glDisable(GL_DEPTH_TEST); glDepthMask(GL_FALSE);
+        glState.useProgram(skyProgram);
+        glState.bindTexture(0,GL_TEXTURE_CUBE_MAP,cube);
+        glState.bindVertexArray(emptyVAO);
+        glDrawArrays(GL_TRIANGLES,0,3);
+        glEnable(GL_DEPTH_TEST); glDepthMask(GL_TRUE);
+        if(pointsFirst<bakedStars){
+            glState.useProgram(starProgram);
+            glState.bindVertexArray(starfieldVAO);
+            glDrawArrays(GL_POINTS,pointsFirst,bakedStars-pointsFirst);
+            frameStats.stars += bakedStars-pointsFirst;
+        }
+    }
+};
+StarSkybox starSkyboxCache;
+
+// --star-catalog <file>: real stars instead of the random field. A HYG-style CSV (ra in hours, dec and mag in
+// degrees and magnitudes, optional ci B-V colour index) is converted once to <file>.starcat, which is mapped
+// and uploaded as it lies. Stars are bucketed into a cube-face grid of sky tiles, each sorted brightest first,
+// so a frame draws only the tiles in the view frustum and each of those only down to the magnitude limit.
+// The limit follows the frame budget: it tightens while the star count runs over, or the frame's CPU work time has
+// run over for several frames in a row, and recovers slowly. Work time excludes the swap, so vsync waits do not count.
+const uint32_t STAR_TILE_GRID = 8;                       // tiles along each cube face edge
+const int STAR_TILE_COUNT = 6*STAR_TILE_GRID*STAR_TILE_GRID;
+const char STAR_CATALOG_MAGIC[4] = {'S','S','S','C'};
+const uint32_t STAR_CATALOG_VERSION = 2;
+const size_t STAR_CSV_BYTES_PER_THREAD = 4<<20;
+struct StarCatalogHeader {
+    char magic[4];
+    uint32_t version, starCount, tileGrid; // StarTile table, StarVertex array, then one float magnitude per star
+    uint64_t sourceSize;
+    int64_t  sourceMtime;
+    uint64_t checksum;                  // fnv1a of everything after the header
+};
+struct StarTile { uint32_t first, count; };
+string starCatalogFile;                 // empty: random starfield
+long long starBudget = 2000000;         // most stars drawn in one frame
+float starGpuBudgetMs = 4.0f;           // GPU time the star draw may take, measured with a timer query
+const int STAR_LIMIT_HYSTERESIS = 8;    // consecutive slow measurements before the limit tightens
+const int STAR_TIMER_QUERIES = 3;       // star draw timings in flight; results are read a frame or two late
+
+int starTileOf(vec3 d){
+    vec3 a = abs(d);
+    int face; float u, v;
+    if(a.x>=a.y && a.x>=a.z){ face = d.x>0 ? 0 : 1; u = d.z/a.x; v = d.y/a.x; }
+    else if(a.y>=a.z){ face = d.y>0 ? 2 : 3; u = d.x/a.y; v = d.z/a.y; }
+    else{ face = d.z>0 ? 4 : 5; u = d.x/a.z; v = d.y/a.z; }
+    int g = (int)STAR_TILE_GRID;
+    int x = std::min(g-1, (int)((u*0.5f+0.5f)*g)), y = std::min(g-1, (int)((v*0.5f+0.5f)*g));
+    return (face*g + y)*g + x;
+}
+// Direction through a point of a tile, (s,t) in [0,1]^2 across it; inverse of starTileOf
+vec3 starTileDir(int tile, float s, float t){
+    int g = (int)STAR_TILE_GRID, face = tile/(g*g), y = tile/g%g, x = tile%g;
+    float u = (x+s)/g*2.0f-1.0f, v = (y+t)/g*2.0f-1.0f, sign = face&1 ? -1.0f : 1.0f;
+    if(face<2) return normalize(vec3(sign, v, u));
+    if(face<4) return normalize(vec3(u, sign, v));
+    return normalize(vec3(u, v, sign));
+}
+// Blackbody colour for a B-V index: Ballesteros' temperature, then a fitted RGB curve, brightest channel at 1
+vec3 starColorFromBV(float bv){
+    bv = glm::clamp(bv, -0.4f, 2.0f);
+    float t = 4600.0f*(1.0f/(0.92f*bv+1.7f) + 1.0f/(0.92f*bv+0.62f)) / 100.0f;
+    float r = t<=66 ? 255.0f : 329.7f*pow(t-60.0f, -0.1332f);
+    float g = t<=66 ? 99.47f*log(t)-161.12f : 288.12f*pow(t-60.0f, -0.0755f);
+    float b = t>=66 ? 255.0f : t<=19 ? 0.0f : 138.52f*log(t-10.0f)-305.04f;
+    vec3 c = glm::clamp(vec3(r,g,b)/255.0f, vec3(0.0f), vec3(1.0f));
+    return c / std::max(c.x, std::max(c.y, c.z));
+}
+// Sirius (-1.5) gets the full point, magnitude 12 and fainter the 0.2 floor of the random field
+float starBrightnessFromMag(float mag){ return glm::clamp(1.0f - (mag+1.5f)/13.5f*0.8f, 0.2f, 1.0f); }
+
+struct CatalogStar { float ra, dec, mag, ci; };
+// Reads the data rows of one newline-aligned chunk; cols gives the field index of ra, dec, mag and ci (-1 if absent)
+void parseStarCsvChunk(const char* p, const char* end, const int cols[4], vector<CatalogStar>& out){
+    int last = std::max(std::max(cols[0],cols[1]), std::max(cols[2],cols[3]));
+    while(p<end){
+        const char* eol = (const char*)memchr(p,'\n',end-p);
+        if(!eol) eol = end;
+        CatalogStar s{0,0,0,0.65f}; // missing ci: roughly solar
+        int found = 0;
+        for(int field=0; p<eol && field<=last; ++field){
+            const char* f = p;
+            if(*p=='"'){ p = (const char*)memchr(p+1,'"',eol-p-1); p = p ? p+1 : eol; }
+            const char* comma = (const char*)memchr(p,',',eol-p);
+            p = comma ? comma : eol;
+            for(int k=0;k<4;++k) if(field==cols[k] && f<p && *f!='"'){
+                float v; if(parseObjFloat(f,p,v)!=f){ (&s.ra)[k] = v; found |= 1<<k; }
+            }
+            if(p<eol) ++p;
+        }
+        if((found&7)==7 && s.mag>-5.0f) out.push_back(s); // the Sun is row 0 of HYG
+        p = eol+1;
+    }
+}
+bool parseStarCsv(const MappedFile& file, vector<CatalogStar>& stars, int threads=0){
+    const char* data = file.data; const char* end = data+file.size;
+    const char* body = (const char*)memchr(data,'\n',file.size);
+    if(!body) return false;
+    int cols[4] = {-1,-1,-1,-1};
+    const char* NAMES[4] = {"ra","dec","mag","ci"};
+    int field = 0;
+    for(const char* p=data; p<body; ++field){
+        const char* comma = (const char*)memchr(p,',',body-p);
+        const char* e = comma ? comma : body;
+        string name(p,e);
+        name.erase(remove_if(name.begin(),name.end(),[](char c){ return c=='"' || isspace((unsigned char)c); }),name.end());
+        transform(name.begin(),name.end(),name.begin(),[](char c){ return (char)tolower((unsigned char)c); });
+        for(int k=0;k<4;++k) if(name==NAMES[k]) cols[k] = field;
+        p = e+1;
+    }
+    if(cols[0]<0 || cols[1]<0 || cols[2]<0){ cerr<<"Star catalog needs ra, dec and mag columns\n"; return false; }
+    ++body;
+    if(threads<=0) threads = (int)std::max(1u, thread::hardware_concurrency());
+    threads = (int)std::max<size_t>(1, std::min<size_t>(threads, (end-body)/STAR_CSV_BYTES_PER_THREAD));
+    vector<const char*> cut(threads+1, end);
+    cut[0] = body;
+    for(int t=1;t<threads;++t){
+        const char* c = body + (end-body)*t/threads;
+        const char* nl = (const char*)memchr(c,'\n',end-c);
+        cut[t] = std::max(cut[t-1], nl ? nl+1 : end);
+    }
+    vector<vector<CatalogStar>> parts(threads);
+    parallelFor(threads,[&](int t){ parseStarCsvChunk(cut[t],cut[t+1],cols,parts[t]); });
+    size_t n = 0; for(auto& p: parts) n += p.size();
+    stars.clear(); stars.reserve(n);
+    for(auto& p: parts) stars.insert(stars.end(),p.begin(),p.end());
+    return true;
+}
+// Buckets the stars into tiles, brightest first in each, and writes the binary catalog
+bool writeStarCatalog(const string& source, const vector<CatalogStar>& stars, const string& path){
+    size_t n = stars.size();
+    vector<uint32_t> tileOf(n), order(n);
+    vector<vec3> dirs(n);
+    for(size_t i=0;i<n;++i){
+        float ra = radians(stars[i].ra*15.0f), dec = radians(stars[i].dec);
+        dirs[i] = vec3(cos(dec)*cos(ra), sin(dec), -cos(dec)*sin(ra)); // celestial pole up
+        tileOf[i] = (uint32_t)starTileOf(dirs[i]);
+    }
+    for(size_t i=0;i<n;++i) order[i] = (uint32_t)i;
+    sort(order.begin(),order.end(),[&](uint32_t a, uint32_t b){
+        return tileOf[a]!=tileOf[b] ? tileOf[a]<tileOf[b] : stars[a].mag<stars[b].mag;
+    });
+    vector<StarTile> tiles(STAR_TILE_COUNT, StarTile{0,0});
+    vector<StarVertex> vertices(n);
+    vector<float> mags(n);
+    for(size_t i=0;i<n;++i){
+        uint32_t s = order[i];
+        StarTile& t = tiles[tileOf[s]];
+        if(t.count==0) t.first = (uint32_t)i;
+        ++t.count;
+        vertices[i] = packStar(dirs[s], starColorFromBV(stars[s].ci), starBrightnessFromMag(stars[s].mag));
+        mags[i] = stars[s].mag;
+    }
+    StarCatalogHeader h{};
+    memcpy(h.magic,STAR_CATALOG_MAGIC,4);
+    h.version = STAR_CATALOG_VERSION; h.starCount = (uint32_t)n; h.tileGrid = STAR_TILE_GRID;
+    if(!meshSourceStamp(source,h.sourceSize,h.sourceMtime)) return false;
+    h.checksum = fnv1a(mags.data(),n*sizeof(float),fnv1a(vertices.data(),n*sizeof(StarVertex),fnv1a(tiles.data(),tiles.size()*sizeof(StarTile))));
+    string tmp = path+".tmp";
+    {
+        ofstream f(tmp, ios::binary);
+        f.write((const char*)&h,sizeof(h));
+        f.write((const char*)tiles.data(),tiles.size()*sizeof(StarTile));
+        f.write((const char*)vertices.data(),n*sizeof(StarVertex));
+        f.write((const char*)mags.data(),n*sizeof(float));
+        if(!f.good()) return false;
+    }
+    error_code ec; filesystem::rename(tmp,path,ec);
+    return !ec;
+}
+
+struct StarCatalog {
+    MappedFile file;
+    uint32_t starCount=0;
+    const StarTile* tiles=nullptr;
+    const StarVertex* vertices=nullptr;
+    const float* mags=nullptr;
+    vec3 tileCenter[STAR_TILE_COUNT]; float tileRadius[STAR_TILE_COUNT]; // bounding spheres of the tiles' caps
+    float magLimit=0, magMin=0, magMax=0;
+    int slowFrames=0;
+    GLuint timers[STAR_TIMER_QUERIES]={}; int timerNext=0, timersPending=0;
+    float gpuMs=0;                      // latest measured GPU time of the star draw
+    vector<GLint> firsts; vector<GLsizei> counts;
+
+    bool loaded() const { return starCount>0; }
+    // Maps path if it is a valid binary catalog of source; source may be the binary itself
+    bool map(const string& path, const string& source){
+        if(!file.open(path)) return false;
+        auto reject = [&](const char* why){ cout<<"Star catalog "<<path<<" "<<why<<"\n"; file.close(); return false; };
+        StarCatalogHeader h;
+        if(file.size<sizeof(h)) return reject("is truncated");
+        memcpy(&h,file.data,sizeof(h));
+        if(memcmp(h.magic,STAR_CATALOG_MAGIC,4)!=0 || h.version!=STAR_CATALOG_VERSION || h.tileGrid!=STAR_TILE_GRID) return reject("has an old format");
+        uint64_t size; int64_t mtime;
+        if(path!=source && (!meshSourceStamp(source,size,mtime) || size!=h.sourceSize || mtime!=h.sourceMtime)) return reject("is stale");
+        if(file.size!=sizeof(h)+STAR_TILE_COUNT*sizeof(StarTile)+(uint64_t)h.starCount*(sizeof(StarVertex)+sizeof(float))) return reject("is corrupt");
+        if(fnv1a((const void*)(file.data+sizeof(h)),file.size-sizeof(h))!=h.checksum) return reject("fails its checksum");
+        starCount = h.starCount;
+        tiles = (const StarTile*)(file.data+sizeof(h));
+        vertices = (const StarVertex*)(tiles+STAR_TILE_COUNT);
+        mags = (const float*)(vertices + starCount);
+        for(int t=0;t<STAR_TILE_COUNT;++t){
+            if((uint64_t)tiles[t].first+tiles[t].count>starCount){ starCount=0; return reject("is corrupt"); }
+            vec3 c = starTileDir(t,0.5f,0.5f);
+            float cosA = 1.0f;
+            for(int k=0;k<4;++k) cosA = std::min(cosA, dot(c, starTileDir(t,(float)(k&1),(float)(k>>1))));
+            tileCenter[t] = c*STAR_FIELD_RADIUS*cosA;
+            tileRadius[t] = STAR_FIELD_RADIUS*sqrt(std::max(0.0f,1.0f-cosA*cosA));
+        }
+        magMin = 1e9f; magMax = -1e9f;
+        for(int t=0;t<STAR_TILE_COUNT;++t) if(tiles[t].count){
+            magMin = std::min(magMin, mags[tiles[t].first]);
+            magMax = std::max(magMax, mags[tiles[t].first+tiles[t].count-1]);
+        }
+        magLimit = magMax;
+        return true;
+    }
+    // Worker side: maps the catalog, converting the CSV first when its binary is missing or out of date
+    bool load(const string& source){
+        auto start = chrono::steady_clock::now();
+        bool binary = source.size()>8 && source.compare(source.size()-8,8,".starcat")==0;
+        string path = binary ? source : source+".starcat";
+        if(!binary && !map(path,source)){
+            MappedFile csv; vector<CatalogStar> stars;
+            if(!csv.open(source) || !parseStarCsv(csv,stars)){ cerr<<"Cannot read star catalog "<<source<<"\n"; return false; }
+            if(!writeStarCatalog(source,stars,path)){ cerr<<"Cannot write "<<path<<"\n"; return false; }
+            printf("Converted %zu stars from %s in %.0f ms\n", stars.size(), source.c_str(),
+                   chrono::duration<double,milli>(chrono::steady_clock::now()-start).count());
+        }
+        if(!loaded() && !map(path,path)) return false;
+        printf("Star catalog: %u stars, magnitudes %.1f to %.1f, %d sky tiles, ready in %.1f ms\n", starCount, magMin, magMax,
+               STAR_TILE_COUNT, chrono::duration<double,milli>(chrono::steady_clock::now()-start).count());
+        return true;
+    }
+    // Takes the oldest star draw timing if the GPU has finished it; never waits
+    bool readTimer(){
+        if(!timersPending) return false;
+        GLuint q = timers[(timerNext+STAR_TIMER_QUERIES-timersPending)%STAR_TIMER_QUERIES];
+        GLint ready = 0; glGetQueryObjectiv(q,GL_QUERY_RESULT_AVAILABLE,&ready);
+        if(!ready) return false;
+        GLuint64 ns = 0; glGetQueryObjectui64v(q,GL_QUERY_RESULT,&ns);
+        gpuMs = (float)(ns*1e-6); --timersPending;
+        return true;
+    }
+    // Draws the tiles that intersect the view frustum down to magLimit, then moves the limit toward the star
+    // and GPU time budgets. Point rasterisation happens after the CPU has moved on, so the time comes from a
+    // GL_TIME_ELAPSED query around the draw, read back once ready.
+    void draw(const mat4& PV){
+        if(!timers[0]) glGenQueries(STAR_TIMER_QUERIES,timers);
+        bool measured = readTimer();
+        vec4 planes[4];
+        for(int i=0;i<2;++i) for(int s=0;s<2;++s){
+            vec4 p;
+            for(int c=0;c<4;++c) p[c] = PV[c][3] + (s ? -PV[c][i] : PV[c][i]);
+            planes[i*2+s] = p / length(vec3(p));
+        }
+        firsts.clear(); counts.clear();
+        long long drawn = 0;
+        for(int t=0;t<STAR_TILE_COUNT;++t){
+            const StarTile& tile = tiles[t];
+            if(!tile.count) continue;
+            bool inside = true;
+            for(const vec4& p: planes) if(dot(vec3(p),tileCenter[t])+p.w < -tileRadius[t]){ inside = false; break; }
+            if(!inside) continue;
+            GLsizei n = (GLsizei)(upper_bound(mags+tile.first, mags+tile.first+tile.count, magLimit) - (mags+tile.first));
+            if(!n) continue;
+            firsts.push_back((GLint)tile.first); counts.push_back(n); drawn += n;
+        }
+        if(!firsts.empty()){
+            bool timed = timersPending<STAR_TIMER_QUERIES;
+            if(timed) glBeginQuery(GL_TIME_ELAPSED,timers[timerNext]);
+            glMultiDrawArrays(GL_POINTS, firsts.data(), counts.data(), (GLsizei)firsts.size());
+            if(timed){ glEndQuery(GL_TIME_ELAPSED); timerNext = (timerNext+1)%STAR_TIMER_QUERIES; ++timersPending; }
+        }
+        frameStats.stars += drawn;
+        if(measured) slowFrames = gpuMs>starGpuBudgetMs ? slowFrames+1 : 0;
+        if(drawn>starBudget || (measured && slowFrames>=STAR_LIMIT_HYSTERESIS)) magLimit = std::max(magMin, magLimit-0.05f);
+        else if(drawn<starBudget*0.9 && gpuMs<starGpuBudgetMs*0.9f) magLimit = std::min(magMax, magLimit+0.01f);
+    }
+};
+StarCatalog starCatalog;
+
+// Conversion and load throughput for a catalog file
+void benchStarCatalog(const string& source){
+    MappedFile csv;
+    if(!csv.open(source)){ cerr<<"Cannot open "<<source<<"\n"; return; }
+    double mb = csv.size/1048576.0;
+    int cores = (int)std::max(1u, thread::hardware_concurrency());
+    vector<CatalogStar> stars;
+    printf("Star catalog: %s (%.1f MB)\n", source.c_str(), mb);
+    for(int threads: {1, cores}){
+        double best = 1e30;
+        for(int run=0;run<3;++run){
+            auto start = chrono::steady_clock::now();
+            if(!parseStarCsv(csv,stars,threads)) return;
+            best = std::min(best, chrono::duration<double,milli>(chrono::steady_clock::now()-start).count());
+        }
+        printf("  CSV parse, %2d thread(s): %8.1f ms  %6.1f MB/s  %6.2f M stars/s\n", threads, best, mb/(best/1000.0), stars.size()/(best*1000.0));
+        if(cores==1) break;
+    }
+    string path = source+".starcat";
+    auto start = chrono::steady_clock::now();
+    writeStarCatalog(source,stars,path);
+    double writeMs = chrono::duration<double,milli>(chrono::steady_clock::now()-start).count();
+    printf("  Tile, sort and write:    %8.1f ms  %6.2f M stars/s\n", writeMs, stars.size()/(writeMs*1000.0));
+    double best = 1e30;
+    for(int run=0;run<5;++run){
+        StarCatalog c;
+        start = chrono::steady_clock::now();
+        c.map(path,source);
+        best = std::min(best, chrono::duration<double,milli>(chrono::steady_clock::now()-start).count());
+    }
+    printf("  Binary map and verify:   %8.1f ms  %6.2f M stars/s\n", best, stars.size()/(best*1000.0));
 }
 void initShootingStars(){
     random_device rd; mt19937 gen(rd());
@@ -534,12 +2787,9 @@ class Moon {
 public:
     vec3 color; float radius, orbitRadius, orbitSpeed, rotationSpeed;
     float currentOrbitAngle=0.0f, currentRotationAngle=0.0f;
-    GLuint VAO=0; int vertexCount=0; GLuint textureID=0;
-    Moon(vec3 c,float r,float oRad,float oSpd,float rotSpd,GLuint tex):color(c),radius(r),orbitRadius(oRad),
-        orbitSpeed(oSpd),rotationSpeed(rotSpd),textureID(tex){
-        auto v = createTexturedSphere(radius, color);
-        VAO = createTexturedSphereVBO(v); vertexCount = (int)v.size()/11;
-    }
+    BodyTexture texture; int lodLevel=-1;
+    Moon(vec3 c,float r,float oRad,float oSpd,float rotSpd,BodyTexture tex):color(c),radius(r),orbitRadius(oRad),
+        orbitSpeed(oSpd),rotationSpeed(rotSpd),texture(tex){}
     void update(float dt){
         if(!pausedOrbits){
             currentOrbitAngle   += orbitSpeed   * dt * orbitSpeedMultiplier;
@@ -558,20 +2808,15 @@ class Planet {
 public:
     vec3 color; float radius, orbitRadius, orbitSpeed, rotationSpeed;
     float currentOrbitAngle=0.0f, currentRotationAngle=0.0f;
-    GLuint VAO=0; int vertexCount=0; GLuint textureID=0;
+    BodyTexture texture; int lodLevel=-1;
     vector<Moon> moons;
-    GLuint ringVAO=0; int ringVertexCount=0; GLuint ringTextureID=0; bool hasRings=false;
+    const Mesh* ringMesh=nullptr; float ringOuterRadius=0; bool hasRings=false; BodyTexture ringTexture;
 
-    Planet(vec3 c,float r,float oRad,float oSpd,float rotSpd,GLuint tex,
-           bool rings=false, GLuint ringTex=0, float ringInner=0, float ringOuter=0)
+    Planet(vec3 c,float r,float oRad,float oSpd,float rotSpd,BodyTexture tex,
+           bool rings=false, BodyTexture ringTex=TEX_RING, float ringInner=0, float ringOuter=0)
         :color(c),radius(r),orbitRadius(oRad),orbitSpeed(oSpd),rotationSpeed(rotSpd),
-         textureID(tex),hasRings(rings),ringTextureID(ringTex){
-        auto v = createTexturedSphere(radius,color);
-        VAO = createTexturedSphereVBO(v); vertexCount=(int)v.size()/11;
-        if(hasRings){
-            auto rv = createRing(ringInner, ringOuter, vec3(1));
-            ringVAO = createTexturedSphereVBO(rv); ringVertexCount=(int)rv.size()/11;
-        }
+         texture(tex),hasRings(rings),ringTexture(ringTex){
+        if(hasRings){ ringMesh = sharedRingMesh(ringInner/ringOuter); ringOuterRadius = ringOuter; }
     }
     void addMoon(const Moon& m){ moons.push_back(m); }
     void update(float dt){
@@ -593,8 +2838,6 @@ int selectedTarget = 2;
 bool followMode = false;
 bool sunLightingOn = true;
 bool isFullscreen = false;
-int currentWindowWidth = WINDOW_WIDTH;
-int currentWindowHeight = WINDOW_HEIGHT;
 
 void framebuffer_size_callback(GLFWwindow* window, int width, int height) {
     currentWindowWidth = width;
@@ -615,6 +2858,100 @@ void mouse_callback(GLFWwindow*, double xpos, double ypos){
     f.z = sin(radians(yaw))*cos(radians(pitch));
     cameraFront = normalize(f);
 }
+// Background asset loading. Workers do the file reads, image decoding and mesh processing; each job hands
+// back a GL step that pump() runs on the GL thread, as many per frame as fit in the upload budget.
+// Every stage is stamped in ms since launch for the startup timeline.
+const double ASSET_UPLOAD_BUDGET_MS = 4.0;
+bool syncAssets = false;                  // --sync-assets: load everything before the first frame
+struct AssetLoader {
+    using Upload = function<void()>;
+    struct Job {
+        string name; function<Upload()> work; Upload upload;
+        double queued=0, workStart=0, workEnd=0, uploadStart=0, uploadEnd=0;
+        int worker=-1, frame=-1;
+    };
+    vector<thread> workers;
+    mutex lock; condition_variable wake, finished;
+    deque<Job*> queue, ready;
+    vector<unique_ptr<Job>> jobs;         // everything submitted, kept for the timeline once its closures have run
+    bool stopping=false;
+    size_t uploaded=0;
+    int frame=0;
+
+    ~AssetLoader(){ stop(); }
+    void start(int count){
+        for(int i=0;i<count;++i) workers.emplace_back([this,i]{
+            unique_lock<mutex> l(lock);
+            for(;;){
+                wake.wait(l,[&]{ return stopping || !queue.empty(); });
+                if(stopping) return;
+                Job* j = queue.front(); queue.pop_front();
+                l.unlock();
+                j->worker = i; j->workStart = msSinceStartup();
+                Upload up = j->work();
+                j->work = nullptr;
+                j->workEnd = msSinceStartup();
+                l.lock();
+                j->upload = std::move(up); ready.push_back(j);
+                finished.notify_all();
+            }
+        });
+    }
+    void stop(){
+        { lock_guard<mutex> l(lock); stopping=true; }
+        wake.notify_all();
+        for(auto& w: workers) w.join();
+        workers.clear();
+    }
+    void submit(const string& name, function<Upload()> work){
+        auto j = make_unique<Job>();
+        j->name = name; j->work = std::move(work); j->queued = msSinceStartup();
+        lock_guard<mutex> l(lock);
+        queue.push_back(j.get()); jobs.push_back(std::move(j));
+        wake.notify_one();
+    }
+    // GL thread: runs finished uploads until the budget is spent, at least one per call
+    int pump(double budgetMs){
+        double start = msSinceStartup(); int count = 0;
+        for(;;){
+            Job* j;
+            {
+                lock_guard<mutex> l(lock);
+                if(ready.empty()) break;
+                j = ready.front(); ready.pop_front();
+            }
+            j->uploadStart = msSinceStartup(); j->frame = frame;
+            if(j->upload) j->upload();
+            j->upload = nullptr; // frees what it captured (decoded pixels, vertex data); the timeline keeps only the stamps
+            j->uploadEnd = msSinceStartup();
+            ++uploaded; ++count;
+            if(j->uploadEnd-start >= budgetMs) break;
+        }
+        ++frame;
+        if(count) glState.invalidateBindings(); // uploads bind buffers and textures directly
+        return count;
+    }
+    bool done(){ lock_guard<mutex> l(lock); return uploaded==jobs.size(); }
+    // GL thread: blocks until every submitted job is uploaded
+    void finishAll(){
+        while(!done()){
+            { unique_lock<mutex> l(lock); finished.wait(l,[&]{ return !ready.empty(); }); }
+            pump(1e30);
+        }
+    }
+    void printTimeline(double firstFrameMs){
+        double last = 0;
+        printf("Startup timeline (ms since launch, first frame at %.1f):\n", firstFrameMs);
+        printf("  %-24s %7s  %-21s %-17s %s\n", "asset", "queued", "worker", "GL upload", "frame");
+        for(auto& j: jobs){
+            printf("  %-24s %7.1f  %7.1f-%7.1f (w%d)  %7.1f-%7.1f  %d\n", j->name.c_str(), j->queued,
+                   j->workStart, j->workEnd, j->worker, j->uploadStart, j->uploadEnd, j->frame);
+            last = std::max(last, j->uploadEnd);
+        }
+        printf("  all %zu assets ready at %.1f ms\n", jobs.size(), last);
+    }
+};
+
 void processInput(GLFWwindow *w){
     if(glfwGetKey(w,GLFW_KEY_ESCAPE)==GLFW_PRESS) glfwSetWindowShouldClose(w,true);
 
@@ -645,6 +2982,14 @@ void processInput(GLFWwindow *w){
         f11Pressed = false;
     }
 
+    static bool lodKeyPressed = false;
+    bool coarser = glfwGetKey(w,GLFW_KEY_RIGHT_BRACKET)==GLFW_PRESS, finer = glfwGetKey(w,GLFW_KEY_LEFT_BRACKET)==GLFW_PRESS;
+    if((coarser || finer) && !lodKeyPressed){
+        lodBias = glm::clamp(lodBias + (coarser ? 0.5f : -0.5f), -4.0f, 4.0f);
+        cout<<"LOD bias: "<<lodBias<<"\n";
+    }
+    lodKeyPressed = coarser || finer;
+
     for(int i=0;i<8;++i){
         if(glfwGetKey(w, GLFW_KEY_1 + i)==GLFW_PRESS) { selectedTarget = i; followMode = true; }
     }
@@ -661,7 +3006,35 @@ void processInput(GLFWwindow *w){
     }
 }
 
-int main(){
+int main(int argc, char** argv){
+    for(int i=1;i<argc;++i){
+        string arg = argv[i];
+        if(arg=="--stats") showFrameStats = true;
+        else if(arg=="--no-shader-cache") shaderCacheEnabled = false;
+        else if(arg=="--no-mesh-cache") meshCacheEnabled = false;
+        else if(arg=="--no-mesh-opt") meshOptimizeEnabled = false;
+        else if(arg=="--packed-vertices") usePackedVertices = true;
+        else if(arg=="--lod-bias" && i+1<argc) lodBias = (float)atof(argv[++i]);
+        else if(arg=="--impostor-px" && i+1<argc) impostorThresholdPx = (float)atof(argv[++i]);
+        else if(arg=="--bench-sphere"){ benchSphere(); return 0; }
+        else if(arg=="--bench-stars"){ benchStarfield(); return 0; }
+        else if(arg=="--bench-catalog" && i+1<argc){ benchStarCatalog(argv[i+1]); return 0; }
+        else if(arg=="--bench-obj"){ benchOBJ(i+1<argc && argv[i+1][0]!='-' ? argv[i+1] : "models/spacecraft.obj"); return 0; }
+        else if(arg=="--procedural-spheres") useProceduralSpheres = true;
+        else if(arg=="--bench-sphere-render") runSphereRenderBench = true;
+        else if(arg=="--sync-assets") syncAssets = true;
+        else if(arg=="--compressed-textures") compressedTextures = true;
+        else if(arg=="--texture-array") textureArray = true;
+        else if(arg=="--star-skybox") starSkybox = true;
+        else if(arg=="--star-count" && i+1<argc) starCount = std::max(0, atoi(argv[++i]));
+        else if(arg=="--seed" && i+1<argc) starSeed = strtoull(argv[++i], nullptr, 0);
+        else if(arg=="--star-catalog" && i+1<argc) starCatalogFile = argv[++i];
+        else if(arg=="--star-budget" && i+1<argc) starBudget = std::max(1LL, atoll(argv[++i]));
+        else if(arg=="--skybox-bright-stars" && i+1<argc){ starSkybox = true; skyboxBrightStars = (float)atof(argv[++i]); }
+        else if(arg=="--texture-budget" && i+1<argc) textureBudgetMB = std::max(0.0f,(float)atof(argv[++i]));
+        else cerr<<"Unknown option: "<<arg<<"\n";
+    }
+
     if(!glfwInit()){ cerr<<"GLFW init fail\n"; return -1; }
     glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR,3);
     glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR,3);
@@ -679,50 +3052,129 @@ int main(){
     glewExperimental = GL_TRUE;
     if(glewInit()!=GLEW_OK){ cerr<<"GLEW init fail\n"; glfwTerminate(); return -1; }
 
+    if(compressedTextures && !GLEW_EXT_texture_compression_s3tc){
+        cout<<"S3TC texture compression not supported, using uncompressed textures\n";
+        compressedTextures = false;
+    }
+    if(compressedTextures && textureArray){
+        cout<<"--texture-array resamples the body textures, they are not read from the compressed cache\n";
+        compressedTextures = false;
+    }
+    if(textureResidency.enabled() && textureArray){
+        cout<<"--texture-budget does not apply to the texture array, every layer stays resident\n";
+        textureBudgetMB = 0;
+    }
+
     glEnable(GL_DEPTH_TEST);
     glEnable(GL_PROGRAM_POINT_SIZE);
     glEnable(GL_BLEND); glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
-    int progMain = linkProgram(VS_MAIN, FS_MAIN);
+    // One program per draw path and variant; the procedural set is only linked when something draws with it
+    bool needProcedural = useProceduralSpheres || runSphereRenderBench;
+    GLuint progMain[DRAW_PATH_COUNT][MAIN_VARIANT_COUNT] = {};
+    for(int v=0;v<MAIN_VARIANT_COUNT;++v){
+        string defines = string(textureArray ? "#define TEXTURE_ARRAY\n" : "")+MAIN_VARIANT_DEFINES[v];
+        progMain[PATH_MESH][v] = linkProgram(VS_MAIN, FS_MAIN.c_str(), ((usePackedVertices ? "#define PACKED_VERTEX\n" : "")+defines).c_str());
+        if(needProcedural) progMain[PATH_PROCEDURAL_SPHERE][v] = linkProgram(VS_MAIN, FS_MAIN.c_str(), ("#define PROCEDURAL_SPHERE\n"+defines).c_str());
+        progMain[PATH_IMPOSTOR][v] = linkProgram(VS_IMPOSTOR, FS_IMPOSTOR.c_str(), defines.c_str());
+    }
     int progStar = linkProgram(VS_STAR, FS_STAR);
     int progShoot= linkProgram(VS_SHOOT, FS_SHOOT);
-
-    createStarfield(progStar);
+    GLuint progSkybox = starSkybox ? linkProgram(VS_SKYBOX, FS_SKYBOX) : 0;
+    cout<<"Shader programs: "<<(shaderCacheStats.hits+shaderCacheStats.misses)<<" ready in "<<shaderCacheStats.ms<<" ms ("
+        <<(shaderCacheStats.misses==0 ? "warm" : "cold")<<": "<<shaderCacheStats.hits<<" from cache, "
+        <<shaderCacheStats.misses<<" compiled, "<<shaderCacheStats.rejected<<" rejected binaries)\n";
+
+    MainUniforms uMain[DRAW_PATH_COUNT][MAIN_VARIANT_COUNT];
+    for(int path=0;path<DRAW_PATH_COUNT;++path){
+        for(int v=0;v<MAIN_VARIANT_COUNT;++v){
+            if(!progMain[path][v]) continue;
+            uMain[path][v].resolve(progMain[path][v]);
+            glUseProgram(progMain[path][v]);
+            glUniform1i(uMain[path][v].texture1, 0);
+        }
+    }
+    glGenVertexArrays(1,&emptyVAO); // core profile needs a VAO bound even without attributes
+    StarUniforms uStar;   uStar.resolve(progStar);
+    glUseProgram(progStar); glUniform1f(uStar.starRadius, STAR_FIELD_RADIUS);
+    ShootUniforms uShoot; uShoot.resolve(progShoot);
     initShootingStars();
 
-    sunTexture     = loadTexture("textures/sun.jpg");
-    mercuryTexture = loadTexture("textures/mercury.jpg");
-    venusTexture   = loadTexture("textures/venus.jpg");
-    earthTexture   = loadTexture("textures/earth.jpg");
-    marsTexture    = loadTexture("textures/mars.jpg");
-    jupiterTexture = loadTexture("textures/jupiter.jpg");
-    saturnTexture  = loadTexture("textures/saturn.jpg");
-    uranusTexture  = loadTexture("textures/uranus.jpg");
-    neptuneTexture = loadTexture("textures/neptune.jpg");
-    moonTexture    = loadTexture("textures/moon.jpg");
-    ringTexture    = loadTexture("textures/rings.jpg");
-
-    vector<float> sunV = createTexturedSphere(3.0f, vec3(1.0f,0.95f,0.7f));
-    GLuint sunVAO = createTexturedSphereVBO(sunV);
-    int sunVerts = (int)sunV.size()/11;
+    if(runSphereRenderBench){
+        for(int l=0;l<SPHERE_LOD_COUNT;++l) sphereLods[l] = createIndexedSphere(SPHERE_LOD_DIMS[l][0], SPHERE_LOD_DIMS[l][1]);
+        createFrameDataUBO();
+        benchSphereRender(uMain);
+        glfwTerminate();
+        return 0;
+    }
+
+    // Everything below streams in while frames are already drawn: bodies show as impostors until their
+    // sphere LOD arrives, textures as checkerboards, the spacecraft as the fallback mesh
+    AssetLoader assets;
+    assets.start(std::max(1,(int)thread::hardware_concurrency()-1));
+    assets.submit("starfield", []{
+        if(!starCatalogFile.empty() && starCatalog.load(starCatalogFile))
+            return AssetLoader::Upload([]{ uploadStarfield(starCatalog.vertices, starCatalog.starCount); });
+        auto V = make_shared<vector<StarVertex>>(generateStarfield());
+        auto bright = make_shared<vector<float>>();
+        if(starSkybox) *bright = sortStarsByBrightness(*V);
+        return AssetLoader::Upload([V,bright]{ uploadStarfield(V->data(), V->size()); starfieldBrightness = std::move(*bright); });
+    });
+    // Procedural spheres need no vertex data at all
+    for(int l=0; l<SPHERE_LOD_COUNT && !useProceduralSpheres; ++l){
+        string name = "Sphere LOD "+to_string(SPHERE_LOD_DIMS[l][0])+"x"+to_string(SPHERE_LOD_DIMS[l][1]);
+        assets.submit(name, [l,name]{
+            auto m = make_shared<Mesh>();
+            buildIndexedSphere(*m, SPHERE_LOD_DIMS[l][0], SPHERE_LOD_DIMS[l][1]);
+            optimizeMesh(*m, name.c_str());
+            reportVertexFormat(name.c_str(), *m, simulateVertexCache(m->indices));
+            return AssetLoader::Upload([l,m]{ m->upload(); sphereLods[l] = std::move(*m); });
+        });
+    }
+    if(textureArray) createBodyTextureArray();
+    for(int layer=0; layer<BODY_TEXTURE_COUNT; ++layer){
+        const char* file = BODY_TEXTURE_FILES[layer];
+        if(textureArray){
+            assets.submit(file, [layer,file]{
+                auto img = make_shared<DecodedImage>(resampleImage(decodeImage(file), TEXTURE_ARRAY_WIDTH, TEXTURE_ARRAY_HEIGHT));
+                return AssetLoader::Upload([layer,file,img]{ uploadTextureLayer(layer,*img,file); });
+            });
+            continue;
+        }
+        GLuint tex = bodyTextures[layer] = createTexture();
+        assets.submit(file, [layer,tex,file]{
+            if(compressedTextures){
+                auto cached = make_shared<CompressedImage>();
+                if(loadTextureCache(file,*cached)) return AssetLoader::Upload([tex,file,cached]{ uploadCompressedTexture(tex,*cached,file); });
+            }
+            auto img = make_shared<DecodedImage>(decodeImage(file));
+            if(compressedTextures && img->data) saveTextureCache(file,*img);
+            if(textureResidency.enabled())
+                return AssetLoader::Upload([layer,tex,file,img]{ textureResidency.adopt((BodyTexture)layer,tex,img,file); });
+            return AssetLoader::Upload([tex,file,img]{ uploadTexture(tex,*img,file); });
+        });
+    }
+
+    const float sunRadius = 3.0f;
+    const vec3 sunColor = vec3(1.0f,0.95f,0.7f);
 
     vector<Planet> planets;
-    planets.emplace_back(vec3(0.7,0.4,0.2), 0.38f, 12.0f, 0.5f, 3.0f, mercuryTexture);
-    planets.emplace_back(vec3(1.0,0.8,0.4), 0.95f, 19.0f, 0.4f, 2.4f, venusTexture);
-    planets.emplace_back(vec3(0.2,0.6,1.0), 1.00f, 26.0f, 0.3f, 2.0f, earthTexture);
-    planets.emplace_back(vec3(0.8,0.3,0.1), 0.53f, 34.0f, 0.25f,1.8f, marsTexture);
-    planets.emplace_back(vec3(0.9,0.7,0.5), 2.50f, 50.0f, 0.15f,1.2f, jupiterTexture);
-    planets.emplace_back(vec3(0.8,0.6,0.4), 2.00f, 70.0f, 0.10f,1.0f, saturnTexture, true, ringTexture, 2.5f, 4.0f);
-    planets.emplace_back(vec3(0.6,0.8,1.0), 1.20f, 90.0f, 0.075f,0.8f, uranusTexture);
-    planets.emplace_back(vec3(0.2,0.4,0.8), 1.20f,110.0f, 0.050f,0.7f, neptuneTexture);
-
-    planets[2].addMoon(Moon(vec3(0.8),0.27f,2.0f,1.0f,2.5f,moonTexture)); // Earth moon
-    planets[3].addMoon(Moon(vec3(0.6),0.15f,1.0f,1.25f,3.0f,moonTexture));
-    planets[3].addMoon(Moon(vec3(0.5),0.12f,1.5f,0.875f,2.8f,moonTexture));
-    planets[4].addMoon(Moon(vec3(1.0,0.9,0.7),0.29f,3.5f,0.5f,1.5f,moonTexture));
-    planets[4].addMoon(Moon(vec3(0.8,0.8,0.9),0.25f,4.5f,0.375f,1.2f,moonTexture));
-    planets[4].addMoon(Moon(vec3(0.7),0.42f,5.5f,0.3f,1.0f,moonTexture));
-    planets[4].addMoon(Moon(vec3(0.6),0.38f,7.0f,0.2f,0.8f,moonTexture));
+    planets.emplace_back(vec3(0.7,0.4,0.2), 0.38f, 12.0f, 0.5f, 3.0f, TEX_MERCURY);
+    planets.emplace_back(vec3(1.0,0.8,0.4), 0.95f, 19.0f, 0.4f, 2.4f, TEX_VENUS);
+    planets.emplace_back(vec3(0.2,0.6,1.0), 1.00f, 26.0f, 0.3f, 2.0f, TEX_EARTH);
+    planets.emplace_back(vec3(0.8,0.3,0.1), 0.53f, 34.0f, 0.25f,1.8f, TEX_MARS);
+    planets.emplace_back(vec3(0.9,0.7,0.5), 2.50f, 50.0f, 0.15f,1.2f, TEX_JUPITER);
+    planets.emplace_back(vec3(0.8,0.6,0.4), 2.00f, 70.0f, 0.10f,1.0f, TEX_SATURN, true, TEX_RING, 2.5f, 4.0f);
+    planets.emplace_back(vec3(0.6,0.8,1.0), 1.20f, 90.0f, 0.075f,0.8f, TEX_URANUS);
+    planets.emplace_back(vec3(0.2,0.4,0.8), 1.20f,110.0f, 0.050f,0.7f, TEX_NEPTUNE);
+
+    planets[2].addMoon(Moon(vec3(0.8),0.27f,2.0f,1.0f,2.5f,TEX_MOON)); // Earth moon
+    planets[3].addMoon(Moon(vec3(0.6),0.15f,1.0f,1.25f,3.0f,TEX_MOON));
+    planets[3].addMoon(Moon(vec3(0.5),0.12f,1.5f,0.875f,2.8f,TEX_MOON));
+    planets[4].addMoon(Moon(vec3(1.0,0.9,0.7),0.29f,3.5f,0.5f,1.5f,TEX_MOON));
+    planets[4].addMoon(Moon(vec3(0.8,0.8,0.9),0.25f,4.5f,0.375f,1.2f,TEX_MOON));
+    planets[4].addMoon(Moon(vec3(0.7),0.42f,5.5f,0.3f,1.0f,TEX_MOON));
+    planets[4].addMoon(Moon(vec3(0.6),0.38f,7.0f,0.2f,0.8f,TEX_MOON));
 
     vector<GLuint> orbitVAOs; vector<int> orbitCounts;
     for(auto& p: planets){
@@ -731,32 +3183,42 @@ int main(){
         orbitCounts.push_back((int)ov.size()/2);
     }
 
-    mat4 P = perspective(radians(45.0f),(float)currentWindowWidth/(float)currentWindowHeight,0.1f,5000.0f);
-    setProjectionMatrix(progMain,P);
-    setProjectionMatrix(progStar,P);
-    setProjectionMatrix(progShoot,P);
-
-    Mesh ship;
-    if(!loadOBJ("models/spacecraft.obj", ship, vec3(0.85f,0.9f,1.0f)))
-        ship = makeFallbackShip();
+    createFrameDataUBO();
+    mat4 P = perspective(radians(FOV_Y),(float)currentWindowWidth/(float)currentWindowHeight,0.1f,5000.0f);
+
+    const float earthRadius = 1.0f, moonRadius = 0.27f;
+
+    Mesh ship = makeFallbackShip();
+    vec3 shipColor = vec3(0.7f,0.7f,0.95f);
+    assets.submit("models/spacecraft.obj", [&ship,&shipColor]{
+        auto prepared = make_shared<PreparedMesh>();
+        bool ok = loadOBJ("models/spacecraft.obj", *prepared);
+        return AssetLoader::Upload([&ship,&shipColor,prepared,ok]{
+            if(!ok){ cout<<"Using fallback ship mesh.\n"; return; }
+            prepared->upload();
+            ship.release();
+            ship = std::move(prepared->mesh);
+            shipColor = vec3(0.85f,0.9f,1.0f);
+        });
+    });
+    if(syncAssets) assets.finishAll();
     vec3 shipPos = vec3(0.0f, 3.0f, 30.0f);
     float shipYaw = 0.0f;
     float shipOrbitAngle = 0.0f;
 
+    glState.invalidateBindings();
     while(!glfwWindowShouldClose(win)){
         float t = (float)glfwGetTime();
         deltaTime = t - lastFrame; lastFrame = t;
 
         processInput(win);
+        assets.pump(ASSET_UPLOAD_BUDGET_MS);
         updateShootingStars(deltaTime);
         
         static int lastWidth = currentWindowWidth;
         static int lastHeight = currentWindowHeight;
         if(lastWidth != currentWindowWidth || lastHeight != currentWindowHeight) {
-            P = perspective(radians(45.0f),(float)currentWindowWidth/(float)currentWindowHeight,0.1f,5000.0f);
-            setProjectionMatrix(progMain,P);
-            setProjectionMatrix(progStar,P);
-            setProjectionMatrix(progShoot,P);
+            P = perspective(radians(FOV_Y),(float)currentWindowWidth/(float)currentWindowHeight,0.1f,5000.0f);
             lastWidth = currentWindowWidth;
             lastHeight = currentWindowHeight;
         }
@@ -781,33 +3243,37 @@ int main(){
         vec3 sunPosition = vec3(0.0f, 0.0f, 0.0f); // sun at origin
         vec3 lightColor = vec3(1.0f, 1.0f, 0.9f);
 
+        if(starfieldVertexCount && starSkybox && starSkyboxCache.stale(currentWindowHeight)) starSkyboxCache.bake(progStar, currentWindowHeight);
+
+        // One buffer update feeds view, projection and lighting to every program
+        FrameData fd;
+        fd.viewMatrix = V;
+        fd.projectionMatrix = P;
+        fd.viewPos = vec4(cameraPosition, 1.0f);
+        fd.sunPosition = vec4(sunPosition, 1.0f);
+        fd.lightColor = vec4(lightColor, 1.0f);
+        updateFrameData(fd);
+
         // Skip shadow mapping entirely
         glViewport(0,0,currentWindowWidth,currentWindowHeight);
         glClearColor(0.0f,0.0f,0.05f,1.0f);
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-        glUseProgram(progStar);
-        setViewMatrix(progStar, V);
-        setProjectionMatrix(progStar, P);
-        glBindVertexArray(starfieldVAO);
-        glDrawArrays(GL_POINTS,0,starfieldVertexCount);
-
-        glUseProgram(progShoot);
-        setViewMatrix(progShoot, V);
-        setProjectionMatrix(progShoot, P);
-        glBindVertexArray(shootingStarVAO);
-        glUniform3f(glGetUniformLocation(progShoot,"starColor"), 1.0f, 0.85f, 0.5f);
-        glUniform1f(glGetUniformLocation(progShoot,"alpha"), 0.85f);
-        glDrawArrays(GL_LINES, 0, shootingStarLineVertexCount);
-
+        if(starfieldVertexCount && starSkybox) starSkyboxCache.draw(progSkybox, progStar);
+        else if(starfieldVertexCount){ // zero until the worker-generated stars are uploaded
+            glState.useProgram(progStar);
+            glState.bindVertexArray(starfieldVAO);
+            if(starCatalog.loaded()) starCatalog.draw(P*V);
+            else{ glDrawArrays(GL_POINTS,0,starfieldVertexCount); frameStats.stars += starfieldVertexCount; }
+        }
 
-        glUseProgram(progMain);
-        setViewMatrix(progMain, V);
-        setProjectionMatrix(progMain, P);
+        glState.useProgram(progShoot);
+        glState.bindVertexArray(shootingStarVAO);
+        glState.uniform3f(uShoot.starColor, 1.0f, 0.85f, 0.5f);
+        glState.uniform1f(uShoot.alpha, 0.85f);
+        glDrawArrays(GL_LINES, 0, shootingStarLineVertexCount);
 
-        glUniform3fv(glGetUniformLocation(progMain,"viewPos"),1,&cameraPosition[0]);
-        glUniform3fv(glGetUniformLocation(progMain,"sunPosition"),1,&sunPosition[0]);
-        glUniform3fv(glGetUniformLocation(progMain,"lightColor"),1,&lightColor[0]);
+        for(auto& p: planets) p.update(deltaTime);
 
         // Get Earth position for moon shadowing (Earth is planets[2])
         vec3 earthPos = vec3(0.0f);
@@ -822,85 +3288,79 @@ int main(){
                 moonPos = vec3(moonMatrix[3]);
             }
         }
-        glUniform3fv(glGetUniformLocation(progMain,"earthPosition"),1,&earthPos[0]);
-        glUniform3fv(glGetUniformLocation(progMain,"moonPosition"),1,&moonPos[0]);
-        glUniform1f(glGetUniformLocation(progMain,"earthRadius"), 1.0f); // Earth radius
-        glUniform1f(glGetUniformLocation(progMain,"moonRadius"), 0.27f); // Moon radius
-
-        setWorldMatrix(progMain, mat4(1));
-        glActiveTexture(GL_TEXTURE0); glBindTexture(GL_TEXTURE_2D, sunTexture);
-        glUniform1i(glGetUniformLocation(progMain,"texture1"), 0);
-        glUniform1i(glGetUniformLocation(progMain,"useTexture"), 1);
-        glUniform1i(glGetUniformLocation(progMain,"isSun"), 1);
-        glUniform1i(glGetUniformLocation(progMain,"useLighting"), 0);
-        glUniform1i(glGetUniformLocation(progMain,"isMoon"), 0);
-        glUniform1i(glGetUniformLocation(progMain,"isEarth"), 0);
-        glUniform3f(glGetUniformLocation(progMain,"Ka"),0.0,0.0,0.0);
-        glUniform3f(glGetUniformLocation(progMain,"Kd"),1.0,1.0,1.0);
-        glUniform3f(glGetUniformLocation(progMain,"Ks"),0.0,0.0,0.0);
-        glUniform1f(glGetUniformLocation(progMain,"shininess"),16.0f);
-        glBindVertexArray(sunVAO);
-        glDrawArrays(GL_TRIANGLES,0,sunVerts);
+
+        MainVariant litVariant = sunLightingOn ? VARIANT_LIT : VARIANT_UNLIT;
+        vector<DrawItem> draws;
+
+        DrawItem sun;
+        sun.variant = VARIANT_EMISSIVE; setBodyTexture(sun, TEX_SUN);
+        // Sphere LOD or impostor from the body's projected size; returns that size in pixels
+        auto placeSphere = [&](DrawItem& d, int& lodLevel, vec3 center, float radius){
+            float px = projectedRadiusPx(center, radius, cameraPosition);
+            int level = selectSphereLod(lodLevel, px);
+            if(px < impostorThresholdPx || (!useProceduralSpheres && sphereLods[level].indexCount==0)) d.path = PATH_IMPOSTOR;
+            else if(useProceduralSpheres){
+                d.path = PATH_PROCEDURAL_SPHERE;
+                d.sphereTess[0] = SPHERE_LOD_DIMS[level][0]; d.sphereTess[1] = SPHERE_LOD_DIMS[level][1];
+            }
+            else d.mesh = &sphereLods[level];
+            return px;
+        };
+
+        static int sunLod = -1;
+        textureResidency.request(TEX_SUN, placeSphere(sun, sunLod, sunPosition, sunRadius));
+        sun.tint = sunColor;
+        sun.world = scale(mat4(1), vec3(sunRadius));
+        draws.push_back(sun);
 
         glLineWidth(1.0f);
-        glUniform1i(glGetUniformLocation(progMain,"useTexture"), 0);
-        glUniform1i(glGetUniformLocation(progMain,"useLighting"),0);
-        glUniform1i(glGetUniformLocation(progMain,"isSun"),0);
-        glUniform1i(glGetUniformLocation(progMain,"isMoon"),0);
-        glUniform1i(glGetUniformLocation(progMain,"isEarth"),0);
         for(size_t i=0;i<orbitVAOs.size();++i){
-            setWorldMatrix(progMain, mat4(1));
-            glBindVertexArray(orbitVAOs[i]);
-            glDrawArrays(GL_LINE_LOOP,0,orbitCounts[i]);
+            DrawItem orbit;
+            orbit.variant = VARIANT_UNLIT; orbit.tint = vec3(0.3f);
+            orbit.vao = orbitVAOs[i]; orbit.mode = GL_LINE_LOOP; orbit.count = orbitCounts[i];
+            draws.push_back(orbit);
         }
 
-        glUniform1i(glGetUniformLocation(progMain,"useLighting"),sunLightingOn ? 1 : 0);
-        glUniform3f(glGetUniformLocation(progMain,"Ka"),0.05f,0.05f,0.05f);
-        glUniform3f(glGetUniformLocation(progMain,"Kd"),0.9f,0.9f,0.9f);
-        glUniform3f(glGetUniformLocation(progMain,"Ks"),0.2f,0.2f,0.2f);
-        glUniform1f(glGetUniformLocation(progMain,"shininess"),32.0f);
-
         for(auto& p: planets){
-            p.update(deltaTime);
-
             mat4 Mp = p.getWorldMatrix();
-            setWorldMatrix(progMain, Mp);
-            glActiveTexture(GL_TEXTURE0);
-            glBindTexture(GL_TEXTURE_2D, p.textureID);
-            glUniform1i(glGetUniformLocation(progMain,"texture1"),0);
-            glUniform1i(glGetUniformLocation(progMain,"useTexture"),1);
-            glUniform1i(glGetUniformLocation(progMain,"isSun"),0);
-            glUniform1i(glGetUniformLocation(progMain,"isMoon"),0);
-            
-            // Check if this is Earth (planets[2])
-            bool currentIsEarth = (&p == &planets[2]);
-            glUniform1i(glGetUniformLocation(progMain,"isEarth"), currentIsEarth ? 1 : 0);
-
-            glBindVertexArray(p.VAO);
-            glDrawArrays(GL_TRIANGLES,0,p.vertexCount);
+            DrawItem body;
+            body.variant = litVariant; setBodyTexture(body, p.texture);
+            float bodyPx = placeSphere(body, p.lodLevel, vec3(Mp[3]), p.radius);
+            textureResidency.request(p.texture, bodyPx);
+            bool followed = followMode && &p==&planets[std::max(0,std::min(selectedTarget,(int)planets.size()-1))];
+            if(followed) textureResidency.prefetch(p.texture);
+            body.tint = p.color;
+            body.world = Mp * scale(mat4(1), vec3(p.radius));
+            // Earth can be eclipsed by its moon (solar eclipse)
+            if(&p == &planets[2] && sunLightingOn){
+                body.variant = VARIANT_LIT_ECLIPSE;
+                body.occluderPosition = moonPos; body.shadowRadius = moonRadius * 2.0f; // Moon casts smaller shadow
+            }
+            draws.push_back(body);
 
             if(p.hasRings){
-                setWorldMatrix(progMain, Mp);
-                glActiveTexture(GL_TEXTURE0);
-                glBindTexture(GL_TEXTURE_2D, p.ringTextureID);
-                glUniform1i(glGetUniformLocation(progMain,"texture1"),0);
-                glUniform1i(glGetUniformLocation(progMain,"useTexture"),1);
-                glBindVertexArray(p.ringVAO);
-                glDrawArrays(GL_TRIANGLES,0,p.ringVertexCount);
+                DrawItem ring = body;
+                ring.variant = litVariant; setBodyTexture(ring, p.ringTexture);
+                ring.mesh = p.ringMesh; ring.path = PATH_MESH; ring.tint = vec3(1);
+                ring.world = Mp * scale(mat4(1), vec3(p.ringOuterRadius));
+                textureResidency.request(p.ringTexture, bodyPx*p.ringOuterRadius/p.radius);
+                if(followed) textureResidency.prefetch(p.ringTexture);
+                draws.push_back(ring);
             }
 
             for(auto& m: p.moons){
+                DrawItem moon;
+                moon.variant = litVariant; setBodyTexture(moon, m.texture);
                 mat4 Mm = Mp * m.getWorldMatrix();
-                setWorldMatrix(progMain, Mm);
-                glActiveTexture(GL_TEXTURE0);
-                glBindTexture(GL_TEXTURE_2D, m.textureID);
-                glUniform1i(glGetUniformLocation(progMain,"texture1"),0);
-                glUniform1i(glGetUniformLocation(progMain,"useTexture"),1);
-                glUniform1i(glGetUniformLocation(progMain,"isSun"),0);
-                glUniform1i(glGetUniformLocation(progMain,"isMoon"),1); // This is a moon
-                glUniform1i(glGetUniformLocation(progMain,"isEarth"),0);
-                glBindVertexArray(m.VAO);
-                glDrawArrays(GL_TRIANGLES,0,m.vertexCount);
+                textureResidency.request(m.texture, placeSphere(moon, m.lodLevel, vec3(Mm[3]), m.radius));
+                moon.tint = m.color;
+                moon.world = Mm * scale(mat4(1), vec3(m.radius));
+                // Earth's moon can be eclipsed by Earth (lunar eclipse)
+                if(&p == &planets[2] && sunLightingOn){
+                    moon.variant = VARIANT_LIT_ECLIPSE;
+                    moon.occluderPosition = earthPos; moon.shadowRadius = earthRadius * 1.2f;
+                }
+                draws.push_back(moon);
             }
         }
 
@@ -910,20 +3370,32 @@ int main(){
             shipOrbitAngle += 0.2f * deltaTime; // Orbital speed
             shipPos = vec3(shipOrbitRadius * cos(shipOrbitAngle), 3.0f + 2.0f * sin(shipOrbitAngle * 2.0f), shipOrbitRadius * sin(shipOrbitAngle));
             
-            mat4 M = translate(mat4(1), shipPos) * rotate(mat4(1), shipYaw, vec3(0,1,0)) * scale(mat4(1), vec3(1.2f));
-            setWorldMatrix(progMain, M);
-            glUniform1i(glGetUniformLocation(progMain,"useTexture"),0);
-            glUniform3f(glGetUniformLocation(progMain,"Ka"),0.08f,0.08f,0.10f);
-            glUniform3f(glGetUniformLocation(progMain,"Kd"),0.95f,0.95f,1.0f);
-            glUniform3f(glGetUniformLocation(progMain,"Ks"),0.6f,0.6f,0.8f);
-            glUniform1f(glGetUniformLocation(progMain,"shininess"),64.0f);
-            ship.drawElements();
+            DrawItem craft;
+            craft.variant = litVariant; craft.mesh = &ship; craft.material = SHIP_MATERIAL; craft.tint = shipColor;
+            craft.world = translate(mat4(1), shipPos) * rotate(mat4(1), shipYaw, vec3(0,1,0)) * scale(mat4(1), vec3(1.2f));
+            craft.meshLod = selectMeshLod(ship, projectedRadiusPx(shipPos, ship.boundRadius*1.2f, cameraPosition));
+            draws.push_back(craft);
 
             shipYaw += 0.2f*deltaTime;
         }
 
+        textureResidency.update(t);
+        submitDraws(draws, uMain);
+
+        reportFrameStats(t);
         glfwSwapBuffers(win);
         glfwPollEvents();
+
+        static double firstFrameMs = -1.0;
+        if(firstFrameMs<0){
+            firstFrameMs = msSinceStartup();
+            cout<<"Time to first frame: "<<firstFrameMs<<" ms\n";
+        }
+        static bool timelineShown = false;
+        if(!timelineShown && assets.done()){
+            timelineShown = true;
+            assets.printTimeline(firstFrameMs);
+        }
     }
 
     glfwTerminate();